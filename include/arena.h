@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+Bump allocator for the results of one batch: output text and translation
+indexes are carved out of big blocks, nothing is freed piece by piece,
+and arena_reset() hands everything back at once.  Blocks stay allocated
+across resets, so once the arena has seen its biggest batch it makes no
+more heap allocations, and what it holds is bounded by that batch.  An
+arena belongs to one thread at a time.
+*/
+
+#define ARENA_BLOCK (1 << 20)   // usual block size, bigger requests get a block to themselves
+
+struct arena_block_s;
+
+struct arena_s {
+    struct arena_block_s *blocks;   // in use up to cur, unused after it
+    struct arena_block_s *cur;
+    size_t used;                    // handed out since the last reset
+    size_t peak;                    // most ever handed out between two resets
+    size_t reserved;                // held in blocks
+    size_t num_blocks;              // block allocations, steady once the arena is warm
+};
+
+void arena_init(struct arena_s *a);
+void arena_free(struct arena_s *a);
+void arena_reset(struct arena_s *a);
+void *arena_alloc(struct arena_s *a, size_t n);
+void *arena_grow(struct arena_s *a, void *p, size_t old, size_t n);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "ingest.h"
+#include "query.h"
+#include "symtab.h"
+
+// decoding of a list of dumps on a task pool, output in list order
+
+#define BATCH_JOBS      256     // dumps decoded between two output flushes
+#define BATCH_MAP_JOBS  16      // the same when walking tables, which bounds the worker arenas
+#define BATCH_MAP_CHUNK 64      // L1 entries per MMU map walk task, 64 tasks per map
+
+struct batch_opts_s {
+    unsigned raw_layout;
+    int use_uring;
+    unsigned workers;
+    int label;          // print "# path" before each dump
+    int map;            // append the MMU map of VMSA dumps that carry RAM images
+    int regions;        // append the coalesced translation regions
+    int translate;      // append the translation of translate_va
+    uint32_t translate_va;
+    const struct query_s *query;    // print only these fields instead of the full text
+    int json;           // one NDJSON object per dump; the map comes as its regions
+    const struct symtab_s *symbols; // annotate map rows, regions and translations, NULL for none
+    int tables_only;    // skip the registers, only map, regions and translation (--cluster)
+};
+
+int batch_run(const struct batch_opts_s *opts, const struct ingest_list_s *list);
+
+// the same, kept warm across several lists (--watch)
+struct batch_s;
+struct batch_s *batch_create(const struct batch_opts_s *opts);
+int batch_decode(struct batch_s *b, const struct ingest_list_s *list, FILE *f);
+void batch_destroy(struct batch_s *b);
+
+#endif
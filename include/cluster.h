@@ -0,0 +1,13 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "ingest.h"
+#include "batch.h"
+
+// --cluster: the per-core dumps of SMP targets, merged per cluster by their Multiprocessor ID
+
+#define CLUSTER_MAX_WORDS 64    // longest layout, PMSA has 58
+
+int cluster_run(const struct batch_opts_s *opts, const struct ingest_list_s *list);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include "ingest.h"
+#include "batch.h"
+
+// --hist, --csv: the --query fields of every dump as columns, for histograms and columnar export
+
+#define COLUMNS_LANES     16    // dumps per transposed block: one AVX-512 or two AVX2 vectors a word
+#define COLUMNS_MAX_WORDS 64    // longest layout, PMSA has 58
+
+enum {
+    COLUMNS_HIST = 1,           // per field, the values seen and how many dumps have each
+    COLUMNS_CSV,                // one row per dump, one column per field
+};
+
+int columns_run(const struct batch_opts_s *opts, const struct ingest_list_s *list, int mode);
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef CPUINFO_H
+#define CPUINFO_H
+
 #include <stdlib.h>
 #include <stdint.h>
 //#include "gui_mbox.h"
@@ -25,6 +28,28 @@ struct l1tblentry_s {
     char *xnbit;
 };
 
+// short descriptor memory types with SCTLR.TRE set: TEX[0]:C:B picks one of
+// eight types from PRRR/NMRR, resolved once per dump by cpuinfo_remap_init()
+struct cpuinfo_remap_s {
+    int tre;
+    char *caching[8];
+    char *memtype[8];
+};
+
+// DACR access types of the 16 domains, and per domain the effective access
+// of each APX:AP[1:0] value, set up once per dump by cpuinfo_dacr_init()
+enum {
+    CPUINFO_DOMAIN_NOACCESS = 0,
+    CPUINFO_DOMAIN_CLIENT,
+    CPUINFO_DOMAIN_RSRVD,
+    CPUINFO_DOMAIN_MANAGER,
+};
+
+struct cpuinfo_dacr_s {
+    uint8_t type[16];
+    char **perms[16];
+};
+
 extern size_t cpuinfo_desc_pmsa_size;
 extern size_t cpuinfo_desc_vmsa_size;
 
@@ -39,6 +64,42 @@ typedef struct cpuinfo_word_desc_s {
     const struct cpuinfo_bitfield_desc_s *fields;
 } cpuinfo_word_desc_s;
 
+// cpuinfo_format() implementations, --decoder
+enum {
+    CPUINFO_DECODER_GENERATED = 0,  // straight-line code from gen_decoders
+    CPUINFO_DECODER_TABLE,          // the descriptor table interpreter
+};
+
+// register layouts a dump can be in, as recorded in the dump file header
+enum {
+    CPUINFO_LAYOUT_UNKNOWN = 0,
+    CPUINFO_LAYOUT_PMSA,
+    CPUINFO_LAYOUT_VMSA,
+    CPUINFO_LAYOUT_V5,
+};
+
 uint32_t get_num_cpuinfo_words();
-void cpuinfo_write_file(uint32_t *cpuinfo);
+const struct cpuinfo_word_desc_s *cpuinfo_get_desc(unsigned layout);
+uint32_t cpuinfo_num_words(unsigned layout);
+const char *cpuinfo_layout_name(unsigned layout);
+unsigned cpuinfo_layout_by_name(const char *name);
+int cpuinfo_word_index(unsigned layout, const char *name);
+struct outbuf_s;
+int cpuinfo_format(struct outbuf_s *ob, const uint32_t *cpuinfo, unsigned layout);
+int cpuinfo_format_field(char *buf, const struct cpuinfo_bitfield_desc_s *field, unsigned fieldval);
+void cpuinfo_set_decoder(int which);
+struct json_s;
+int cpuinfo_format_json(struct json_s *j, const uint32_t *cpuinfo, unsigned layout);
+void cpuinfo_write_file(const uint32_t *cpuinfo, unsigned layout);
+char *cpuinfo_accperm(unsigned apx_ap);
+void cpuinfo_dacr_init(struct cpuinfo_dacr_s *d, uint32_t dacr);
+const char *cpuinfo_domain_type(const struct cpuinfo_dacr_s *d, unsigned domain);
+char *cpuinfo_effperm(const struct cpuinfo_dacr_s *d, unsigned domain, unsigned apx_ap);
+void cpuinfo_texcb(unsigned f, char **caching, char **memtype);
+void cpuinfo_remap_init(struct cpuinfo_remap_s *r, uint32_t sctlr, uint32_t prrr, uint32_t nmrr);
+void cpuinfo_memattr(unsigned f, const struct cpuinfo_remap_s *remap, char **caching, char **memtype);
+unsigned interpret_l1_table_entry(unsigned e, const struct cpuinfo_remap_s *remap, char *buf);
+unsigned interpret_l2_table_entry(unsigned e, const struct cpuinfo_remap_s *remap, char *buf);
 void cpuinfo_finish(unsigned dummy);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef DUMPFILE_H
+#define DUMPFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Framed dump container.
+
+    struct dumpfile_hdr_s                  header
+    uint32_t words[num_words]              register words, in layout order
+    struct dumpfile_image_s [num_images]   page-table / RAM image descriptors
+    image data                             each image's bytes, back to back
+
+All fields are little-endian.  The checksum covers everything after the
+header.  Files without the magic are treated as legacy raw dumps, which
+are just the register words as written by the camera.
+
+Either kind may be gzip or zstd compressed.  dumpfile_open() then reads
+the registers through a bounded buffer and leaves the images in the
+stream: they get an anonymous mapping that is decompressed into as far
+as dumpfile_phys() is asked to reach, so a dump decoded without --map
+never inflates its images at all.  The container checksum is not
+checked on compressed files, the images are never all there to sum;
+the codec's own checks cover the bytes that are read.
+*/
+
+#define DUMPFILE_MAGIC   0x49555043 // "CPUI"
+#define DUMPFILE_VERSION 1
+
+struct dumpfile_hdr_s {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t layout;        // CPUINFO_LAYOUT_*
+    uint32_t hdr_size;      // sizeof(struct dumpfile_hdr_s)
+    uint32_t num_words;
+    uint32_t num_images;
+    uint32_t checksum;
+    uint64_t total_size;    // header + payload, must match the file size
+};
+
+struct dumpfile_image_s {
+    uint64_t phys_addr;     // physical address of the first byte
+    uint64_t size;          // bytes, multiple of 4
+};
+
+enum {
+    DUMPFILE_OK = 0,
+    DUMPFILE_ERR_IO = -1,
+    DUMPFILE_ERR_SIZE = -2,
+    DUMPFILE_ERR_VERSION = -3,
+    DUMPFILE_ERR_LAYOUT = -4,
+    DUMPFILE_ERR_WORDS = -5,
+    DUMPFILE_ERR_IMAGES = -6,
+    DUMPFILE_ERR_CHECKSUM = -7,
+    DUMPFILE_ERR_CODEC = -8,
+};
+
+struct dumpfile_lazy_s;
+
+struct dumpfile_s {
+    void *map;              // mapping owned by dumpfile_open(), NULL otherwise
+    size_t map_size;
+    unsigned version;       // 0 for legacy raw dumps
+    unsigned layout;
+    const uint32_t *words;
+    uint32_t num_words;
+    uint32_t num_images;
+    const struct dumpfile_image_s *images;
+    const uint8_t *image_data;
+    struct dumpfile_lazy_s *lazy;   // compressed file, image_data is filled on demand
+};
+
+struct dumpfile_sum_s {
+    uint32_t a, b;
+};
+
+int dumpfile_open(const char *path, unsigned raw_layout, struct dumpfile_s *df);
+int dumpfile_is_compressed(const void *buf, size_t len);
+int dumpfile_parse(const void *buf, size_t len, unsigned raw_layout, struct dumpfile_s *df);
+void dumpfile_close(struct dumpfile_s *df);
+int dumpfile_error(const struct dumpfile_s *df);
+const char *dumpfile_strerror(int err);
+
+const void *dumpfile_phys(const struct dumpfile_s *df, uint64_t pa, uint64_t len);
+const void *dumpfile_image(const struct dumpfile_s *df, uint32_t n);
+
+void dumpfile_sum_init(struct dumpfile_sum_s *sum);
+void dumpfile_sum_update(struct dumpfile_sum_s *sum, const void *data, size_t len);
+uint32_t dumpfile_sum_final(const struct dumpfile_sum_s *sum);
+
+int dumpfile_write(FILE *f, unsigned layout, const uint32_t *words, uint32_t num_words,
+                   const struct dumpfile_image_s *images, const void *const *image_data,
+                   uint32_t num_images);
+
+#endif
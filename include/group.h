@@ -0,0 +1,15 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "ingest.h"
+#include "batch.h"
+
+// --group: bucket dumps into classes that differ only in masked (volatile) words
+
+#define GROUP_MAX_WORDS 64      // longest layout, PMSA has 58
+#define GROUP_MAX_MASK  16
+
+int group_run(const struct batch_opts_s *opts, const struct ingest_list_s *list,
+              const char *const *mask, unsigned num_mask);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stddef.h>
+
+// bulk reading of many small dump files, via io_uring where the kernel has it
+
+#define INGEST_BUF_SIZE 4096    // per-file read buffer, comfortably above a register dump
+#define INGEST_DEPTH    64      // files in flight at once
+
+// status passed to the callback, besides negative errno values
+enum {
+    INGEST_OK = 0,
+    INGEST_PARTIAL = 1,     // buffer filled up, file may be larger than INGEST_BUF_SIZE
+};
+
+// called once per file, in list order; buf is only valid during the call
+typedef void (*ingest_fn)(void *ctx, size_t index, const char *path,
+                          const void *buf, size_t len, int status);
+
+struct ingest_list_s {
+    char **paths;
+    size_t num;
+    size_t cap;
+};
+
+int ingest_list_add(struct ingest_list_s *list, const char *path);
+void ingest_list_free(struct ingest_list_s *list);
+
+int ingest_files(const struct ingest_list_s *list, int use_uring, ingest_fn fn, void *ctx);
+
+#endif
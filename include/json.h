@@ -0,0 +1,34 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdint.h>
+
+#include "outbuf.h"
+
+/*
+Streaming JSON writer into an outbuf.  Nothing is allocated besides the
+outbuf growing, which stops once it has seen the largest dump; the
+writer itself is a few words of state, commas are tracked with one bit
+per nesting level.  key is NULL for array members.
+*/
+
+#define JSON_MAX_DEPTH 32
+
+struct json_s {
+    struct outbuf_s *ob;
+    unsigned depth;
+    uint32_t nonempty;      // bit n: level n already has a member
+};
+
+void json_begin(struct json_s *j, struct outbuf_s *ob);
+void json_end(struct json_s *j);
+void json_object(struct json_s *j, const char *key);
+void json_object_end(struct json_s *j);
+void json_array(struct json_s *j, const char *key);
+void json_array_end(struct json_s *j);
+void json_string(struct json_s *j, const char *key, const char *val);
+void json_uint(struct json_s *j, const char *key, uint64_t val);
+void json_bool(struct json_s *j, const char *key, int val);
+void json_null(struct json_s *j, const char *key);
+
+#endif
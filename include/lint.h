@@ -0,0 +1,35 @@
+#ifndef LINT_H
+#define LINT_H
+
+#include <stdint.h>
+
+#include "ingest.h"
+#include "batch.h"
+
+// --lint: translation table anomalies of every dump, counted per rule over the whole list
+
+enum {
+    LINT_UNALIGNED_SUPERSECTION,
+    LINT_INCONSISTENT_SUPERSECTION,
+    LINT_UNALIGNED_LARGE_PAGE,
+    LINT_INCONSISTENT_LARGE_PAGE,
+    LINT_TABLE_NOT_IN_IMAGE,        // L2 (LPAE: L2 or L3) table the descriptor points at
+    LINT_RESERVED_AP,               // APX:AP 100 or 111, "rsrvd" in the map
+    LINT_WRITABLE_EXEC,             // privileged writable and executable, after DACR
+    LINT_MEMTYPE_ALIAS,             // a PA mapped at two VAs with different memory types
+    LINT_RULES
+};
+
+#define LINT_JOBS 64            // dumps linted between two output flushes
+
+// findings of one dump
+struct lint_dump_s {
+    uint64_t count[LINT_RULES];
+    uint32_t first_va[LINT_RULES];  // lowest VA of the rule's findings
+};
+
+void lint_report(struct lint_dump_s *d, unsigned rule, uint32_t va, uint64_t n);
+
+int lint_run(const struct batch_opts_s *opts, const struct ingest_list_s *list);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef LPAE_H
+#define LPAE_H
+
+#include <stdint.h>
+
+#include "outbuf.h"
+#include "xlat.h"
+
+// long-descriptor translation tables, used by mmumap.c when TTBCR.EAE is set
+
+struct mmumap_s;
+struct lint_dump_s;
+
+int lpae_init(struct mmumap_s *m);
+void lpae_walk(const struct mmumap_s *m, uint32_t va, uint64_t end, struct outbuf_s *ob);
+size_t lpae_rows(const struct mmumap_s *m, uint32_t va, uint64_t end);
+void lpae_index(const struct mmumap_s *m, uint32_t va, uint64_t end, struct xlat_s *x);
+void lpae_lint(const struct mmumap_s *m, struct lint_dump_s *d);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef MAPOUT_H
+#define MAPOUT_H
+
+#include "mmumap.h"
+#include "taskpool.h"
+
+// --map-out: the MMU map of one dump, written by the workers straight into a mapped file
+
+#define MAPOUT_CHUNK 64         // L1 entries, or 1 MB VA steps, per task
+
+int mapout_write(const struct mmumap_s *m, const char *path, struct taskpool_s *pool);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef MMUMAP_H
+#define MMUMAP_H
+
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "dumpfile.h"
+#include "outbuf.h"
+#include "xlat.h"
+
+struct symtab_s;
+struct lint_dump_s;
+
+#define MMUMAP_L1_ENTRIES 4096
+#define MMUMAP_L2_ENTRIES 256
+#define MMUMAP_LPAE_ENTRIES 512
+#define MMUMAP_ROW_MAX 192      // longest walk row, without its symbol column
+
+extern const char *csvhead;
+extern const char *csvhead_symbols;
+
+enum {
+    MMUMAP_ERR_LAYOUT = -1,
+    MMUMAP_ERR_TT0 = -2,
+    MMUMAP_ERR_TT1 = -3,
+};
+
+// the VA range translated through one TTBR, with long descriptors
+struct mmumap_lpae_ttbr_s {
+    uint32_t va_first, va_last;
+    unsigned level;                 // lookup start level, 1 or 2; 0 if the range is unused or walks are disabled
+    unsigned entries;               // in the start level table
+    uint64_t adr;
+    const uint64_t *tbl;
+};
+
+// translation tables of one dump, as found in its RAM images
+struct mmumap_s {
+    const struct dumpfile_s *df;
+    struct mmuregs_s regs;
+    int lpae;                       // TTBCR.EAE, long-descriptor tables
+    // short descriptors
+    unsigned tt0_entries;           // L1 entries translated through TTBR0
+    uint32_t tt0adr, tt1adr;
+    const uint32_t *tt0;            // entry for VA 0, indexed by L1 entry n
+    const uint32_t *tt1;            // entry for the first TTBR1 VA (n = tt0_entries), indexed by n - tt0_entries
+    // long descriptors
+    struct mmumap_lpae_ttbr_s ttbr[2];
+    uint32_t mair[2];               // PRRR and NMRR are MAIR0 and MAIR1 with EAE set
+    struct cpuinfo_remap_s remap;   // short descriptors with SCTLR.TRE set
+    struct cpuinfo_dacr_s dacr;     // short descriptors: domain access types
+    const struct symtab_s *syms;    // adds a Symbol column to the rows, NULL for none
+};
+
+int mmumap_init_vmsa(struct mmumap_s *m, const struct dumpfile_s *df);
+const char *mmumap_strerror(int err);
+void mmumap_walk(const struct mmumap_s *m, unsigned first, unsigned count, struct outbuf_s *ob);
+size_t mmumap_rows(const struct mmumap_s *m, unsigned first, unsigned count);
+void mmumap_row_end(const struct mmumap_s *m, uint32_t va, const char *conclude, struct outbuf_s *ob);
+void mmumap_index(const struct mmumap_s *m, unsigned first, unsigned count, struct xlat_s *x);
+void mmumap_lint(const struct mmumap_s *m, struct lint_dump_s *d);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+struct arena_s;
+
+// growable text buffer; reset keeps the allocation so buffers can be reused per dump
+struct outbuf_s {
+    char *data;
+    size_t len;
+    size_t cap;
+    struct arena_s *arena;      // grows in this arena instead of the heap, NULL for the heap
+    int fixed;                  // data is someone else's memory and cannot grow
+};
+
+void outbuf_init(struct outbuf_s *ob);
+void outbuf_init_arena(struct outbuf_s *ob, struct arena_s *arena);
+void outbuf_init_fixed(struct outbuf_s *ob, char *data, size_t cap);
+void outbuf_free(struct outbuf_s *ob);
+void outbuf_reset(struct outbuf_s *ob);
+char *outbuf_reserve(struct outbuf_s *ob, size_t n);
+void outbuf_write(struct outbuf_s *ob, const void *data, size_t n);
+void outbuf_puts(struct outbuf_s *ob, const char *s);
+void outbuf_csv_cell(struct outbuf_s *ob, const char *s);
+void outbuf_printf(struct outbuf_s *ob, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int outbuf_flush(struct outbuf_s *ob, FILE *f);
+int outbuf_flushv(struct outbuf_s *const *bufs, unsigned n, FILE *f);
+
+#endif
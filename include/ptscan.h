@@ -0,0 +1,28 @@
+#ifndef PTSCAN_H
+#define PTSCAN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "taskpool.h"
+
+// search for short-descriptor L1 tables in a RAM image when TTBR0/TTBR1 can't be trusted
+
+#define PTSCAN_MAX_HITS 16
+
+struct ptscan_hit_s {
+    uint64_t pa;            // physical address of the candidate table
+    int score;
+    unsigned sections;
+    unsigned supersections;
+    unsigned l2_inside;     // L2 refs to a table inside the image
+    unsigned l2_outside;
+    unsigned invalid;       // reserved type/AP encodings, SBZ bits, broken supersections
+};
+
+unsigned ptscan_image(struct taskpool_s *pool, uint64_t base, const void *data, uint64_t size,
+                      struct ptscan_hit_s *hits, unsigned max_hits);
+void ptscan_print(FILE *f, const struct ptscan_hit_s *hits, unsigned num_hits);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "outbuf.h"
+
+// --query: extract a few "Word.Field" values from each dump instead of the full text
+
+#define QUERY_MAX_PATHS 64
+
+enum {
+    QUERY_OK = 0,
+    QUERY_ERR_UNKNOWN = -1,     // path names no word or field in any layout
+    QUERY_ERR_TOO_MANY = -2,
+};
+
+// a path resolved against one layout's descriptor table
+struct query_field_s {
+    int word;                                       // -1: not in this layout
+    unsigned shift;
+    unsigned bits;
+    const struct cpuinfo_bitfield_desc_s *field;    // NULL: the whole word
+};
+
+struct query_s {
+    unsigned num;
+    const char *paths[QUERY_MAX_PATHS];
+    struct query_field_s fields[CPUINFO_LAYOUT_V5 + 1][QUERY_MAX_PATHS];
+};
+
+int query_compile(struct query_s *q, const char *const *paths, unsigned num, unsigned *bad);
+int query_format(const struct query_s *q, struct outbuf_s *ob, const uint32_t *words, unsigned layout);
+struct json_s;
+int query_format_json(const struct query_s *q, struct json_s *j, const uint32_t *words, unsigned layout);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+Per-stage counters and cycle timers for --stats.  Each thread bumps its
+own block, so the hot path is a few adds and no atomics; blocks are only
+summed when the report is printed.  Until stats_start() is called, which
+only --stats does, each macro is one well predicted test of stats_on and
+reads no clock.  Built without CPUINFO_STATS every macro below compiles
+to nothing.
+*/
+
+enum {
+    STAT_READ,          // reading dump files
+    STAT_DECODE,        // cpuinfo_format(), per dump
+    STAT_DESC_FN,       // desc_fn interpretation of a field
+    STAT_L1,            // interpret_l1_table_entry(), LPAE first and second level
+    STAT_L2,            // interpret_l2_table_entry(), LPAE third level
+    STAT_WALK,          // MMU map walk task, per chunk
+    STAT_WRITE,         // writing output
+    STAT_ARENA,         // arena blocks taken from the heap; peak: most arena bytes in use at once
+    STAT_LINT,          // --lint, per dump
+    STAT_NUM
+};
+
+struct stats_s {
+    uint64_t count[STAT_NUM];
+    uint64_t bytes[STAT_NUM];
+    uint64_t ticks[STAT_NUM];
+    uint64_t peak[STAT_NUM];
+    struct stats_s *next;
+};
+
+#ifdef CPUINFO_STATS
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+static inline uint64_t stats_now(void) {
+    return __rdtsc();
+}
+#define STATS_UNIT "cycles"
+#else
+#include <time.h>
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#define STATS_UNIT "ns"
+#endif
+
+extern int stats_on;
+extern __thread struct stats_s *stats_self;
+struct stats_s *stats_register(void);
+
+static inline struct stats_s *stats_local(void) {
+    return stats_self ? stats_self : stats_register();
+}
+
+#define STATS_TIMER(t)              uint64_t t = stats_on ? stats_now() : 0
+#define STATS_STOP(stage, t, n)     do { if (stats_on) { struct stats_s *s_ = stats_local(); \
+                                         s_->count[stage]++; s_->bytes[stage] += (n); \
+                                         s_->ticks[stage] += stats_now() - (t); } } while (0)
+#define STATS_ADD(stage, c, n)      do { if (stats_on) { struct stats_s *s_ = stats_local(); \
+                                         s_->count[stage] += (c); s_->bytes[stage] += (n); } } while (0)
+#define STATS_ADD_TICKS(stage, t)   do { if (stats_on) \
+                                         stats_local()->ticks[stage] += stats_now() - (t); } while (0)
+#define STATS_PEAK(stage, n)        do { if (stats_on) { struct stats_s *s_ = stats_local(); \
+                                         if ((n) > s_->peak[stage]) s_->peak[stage] = (n); } } while (0)
+
+#else
+
+#define STATS_TIMER(t)              do { } while (0)
+#define STATS_STOP(stage, t, n)     do { (void)(n); } while (0)
+#define STATS_ADD(stage, c, n)      do { (void)(c); (void)(n); } while (0)
+#define STATS_ADD_TICKS(stage, t)   do { } while (0)
+#define STATS_PEAK(stage, n)        do { (void)(n); } while (0)
+
+#endif
+
+int stats_enabled(void);
+void stats_start(void);
+void stats_report(FILE *f, int json);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "outbuf.h"
+
+/*
+--symbols: firmware symbols and sections for annotating the MMU map.
+One symbol per line, "ADDR [SIZE] [TYPE] NAME" with hex numbers, which
+covers nm -S output and plain address lists; '#' starts a comment line.
+*/
+
+struct symtab_sym_s {
+    uint32_t addr;
+    uint32_t size;          // 0: unknown, the symbol runs up to the next one
+    uint32_t name;          // offset into names
+    uint32_t parent;        // innermost sized symbol that contains this one, SYMTAB_NONE if none
+};
+
+#define SYMTAB_NONE 0xffffffff
+
+struct symtab_s {
+    struct symtab_sym_s *syms;  // sorted by addr
+    unsigned num;
+    uint32_t *eytz;             // addresses in Eytzinger (BFS) order, 1-based
+    uint32_t *eytz_pos;         // position in syms of each eytz entry
+    struct outbuf_s names;
+    size_t max_name;            // longest name, for sizing output up front
+};
+
+int symtab_load(struct symtab_s *st, const char *path);
+void symtab_free(struct symtab_s *st);
+const struct symtab_sym_s *symtab_find(const struct symtab_s *st, uint32_t addr);
+const char *symtab_name(const struct symtab_s *st, const struct symtab_sym_s *sym);
+void symtab_annotate(const struct symtab_s *st, uint32_t addr, struct outbuf_s *ob);
+
+#endif
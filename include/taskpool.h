@@ -0,0 +1,25 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+/*
+Work-stealing task pool.  Each worker owns a deque: it pushes and pops
+its own tasks at the bottom, idle workers steal from the top of the
+others.  Tasks submitted from a worker go to that worker's deque, so a
+big job that splits itself keeps its pieces local until someone is idle
+enough to take them.
+*/
+
+#define TASKPOOL_MAX_WORKERS 1024   // -j beyond this is a typo, not a machine
+
+typedef void (*task_fn)(void *arg, unsigned worker);
+
+struct taskpool_s;
+
+struct taskpool_s *taskpool_create(unsigned num_workers);
+void taskpool_destroy(struct taskpool_s *pool);
+unsigned taskpool_num_workers(const struct taskpool_s *pool);
+void taskpool_submit(struct taskpool_s *pool, task_fn fn, void *arg);
+void taskpool_wait(struct taskpool_s *pool);
+unsigned taskpool_default_workers(void);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "batch.h"
+
+// --watch: decode dumps as they land in a directory, until SIGINT/SIGTERM
+
+int watch_run(const struct batch_opts_s *opts, const char *dir, const char *out_dir);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef XLAT_H
+#define XLAT_H
+
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "outbuf.h"
+
+/*
+Translation index of one dump: the VA ranges that translate, with their
+physical address and attributes, in VA order.  The table walkers add
+mappings as they find them, and mappings that continue the previous one
+(next VA, next PA, same attributes) are merged into it, so the index is
+also the coalesced region list.
+*/
+
+enum {
+    XLAT_SHORT = 1,             // short-descriptor tables
+    XLAT_LONG,                  // long-descriptor (LPAE) tables
+};
+
+#define XLAT_NO_DOMAIN 16
+
+// kept as bytes with no padding so attributes can be compared with memcmp
+struct xlat_attr_s {
+    uint8_t format;             // XLAT_SHORT, XLAT_LONG
+    uint8_t ap;                 // APX:AP[1:0]; long AP[2:1] 00, 01, 10, 11 map to 1, 3, 5, 6
+    uint8_t xn;
+    uint8_t pxn;
+    uint8_t domain;             // XLAT_NO_DOMAIN for long descriptors
+    uint8_t memattr;            // short: TEX[2:0]:C:B, long: AttrIndx
+    uint8_t shareable;          // short: S bit, long: SH[1:0]
+    uint8_t ng;
+    uint8_t ns;
+};
+
+struct xlat_region_s {
+    uint32_t va;
+    uint64_t pa;
+    uint64_t size;
+    struct xlat_attr_s attr;
+};
+
+struct arena_s;
+
+struct xlat_s {
+    struct xlat_region_s *regions;
+    unsigned num, cap;
+    struct arena_s *arena;      // regions grow in this arena instead of the heap, NULL for the heap
+    uint32_t mair[2];           // long descriptors: MAIR0/MAIR1, which share PRRR/NMRR
+    struct cpuinfo_remap_s remap;   // short descriptors with SCTLR.TRE set
+    struct cpuinfo_dacr_s dacr;     // short descriptors: domain access types
+};
+
+extern const char *regionhead;
+extern const char *translatehead;
+
+void xlat_init(struct xlat_s *x);
+void xlat_init_arena(struct xlat_s *x, struct arena_s *arena);
+void xlat_free(struct xlat_s *x);
+void xlat_reset(struct xlat_s *x);
+void xlat_add(struct xlat_s *x, uint32_t va, uint64_t pa, uint64_t size, const struct xlat_attr_s *attr);
+void xlat_append(struct xlat_s *x, const struct xlat_s *src);
+const struct xlat_region_s *xlat_lookup(const struct xlat_s *x, uint32_t va);
+
+unsigned xlat_run32(const uint32_t *e, unsigned n, uint32_t step);
+unsigned xlat_run64(const uint64_t *e, unsigned n, uint64_t step);
+
+void xlat_memattr(const struct xlat_attr_s *a, const uint32_t *mair, const struct cpuinfo_remap_s *remap,
+                  char *caching, const char **memtype);
+const char *xlat_shareable(const struct xlat_attr_s *a);
+const char *xlat_xn(const struct xlat_attr_s *a);
+const char *xlat_effperm(const struct xlat_s *x, const struct xlat_attr_s *a);
+
+// syms: adds the symbol of each region start or VA, NULL for none
+struct symtab_s;
+void xlat_print_regions(const struct xlat_s *x, const struct symtab_s *syms, struct outbuf_s *ob);
+void xlat_print_translation(const struct xlat_s *x, uint32_t va, const struct symtab_s *syms, struct outbuf_s *ob);
+struct json_s;
+void xlat_json_regions(const struct xlat_s *x, const struct symtab_s *syms, struct json_s *j);
+void xlat_json_translation(const struct xlat_s *x, uint32_t va, const struct symtab_s *syms, struct json_s *j);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef ZREAD_H
+#define ZREAD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+Streaming decompression of gzip and zstd files through a bounded input
+buffer.  Each codec is compiled in with its Makefile switch (GZIP=1,
+ZSTD=1); the magic numbers are recognised either way, so a compressed
+file the build cannot read is reported as such instead of as a bad dump.
+*/
+
+enum {
+    ZREAD_NONE = 0,
+    ZREAD_GZIP,
+    ZREAD_ZSTD,
+};
+
+#define ZREAD_IN_SIZE 65536     // compressed bytes read at a time
+
+struct zread_s;
+
+int zread_detect(const void *buf, size_t len);
+int zread_supported(int codec);
+struct zread_s *zread_open(int fd, int codec);
+ssize_t zread_read(struct zread_s *z, void *buf, size_t len);
+void zread_close(struct zread_s *z);
+void *zread_load(int fd, int codec, size_t *size);
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "stats.h"
+
+#define ARENA_ALIGN 16
+
+struct arena_block_s {
+    struct arena_block_s *next;
+    size_t size;
+    size_t used;
+    char *data;                     // ARENA_ALIGN aligned, right after the header
+};
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void arena_init(struct arena_s *a) {
+    memset(a, 0, sizeof(*a));
+}
+
+void arena_free(struct arena_s *a) {
+    struct arena_block_s *b, *next;
+    for (b = a->blocks; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+    arena_init(a);
+}
+
+// makes the block after cur one with room for n: the smallest unused
+// block that is big enough, so big blocks are left for big requests, or
+// a new one
+static void next_block(struct arena_s *a, size_t n) {
+    struct arena_block_s **pp, **best = NULL;
+    struct arena_block_s *b;
+
+    for (pp = a->cur ? &a->cur->next : &a->blocks; *pp; pp = &(*pp)->next) {
+        if ((*pp)->size >= n && (best == NULL || (*pp)->size < (*best)->size)) {
+            best = pp;
+        }
+    }
+    if (best) {
+        b = *best;
+        *best = b->next;
+    }
+    else {
+        size_t size = n > ARENA_BLOCK ? n : ARENA_BLOCK;
+        b = malloc(sizeof(*b) + ARENA_ALIGN + size);
+        if (b == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        b->size = size;
+        b->data = (char *)(((uintptr_t)(b + 1) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+        a->reserved += size;
+        a->num_blocks++;
+        STATS_ADD(STAT_ARENA, 1, size);
+    }
+    b->used = 0;
+    if (a->cur) {
+        b->next = a->cur->next;
+        a->cur->next = b;
+    }
+    else {
+        b->next = a->blocks;
+        a->blocks = b;
+    }
+    a->cur = b;
+}
+
+void *arena_alloc(struct arena_s *a, size_t n) {
+    char *p;
+    n = align_up(n ? n : 1);
+    if (a->cur == NULL || a->cur->size - a->cur->used < n) {
+        next_block(a, n);
+    }
+    p = a->cur->data + a->cur->used;
+    a->cur->used += n;
+    a->used += n;
+    return p;
+}
+
+// realloc() for the arena: the latest allocation grows in place while its
+// block has room, anything else is copied to a new allocation
+void *arena_grow(struct arena_s *a, void *p, size_t old, size_t n) {
+    struct arena_block_s *b = a->cur;
+    size_t old_size = align_up(old), new_size = align_up(n);
+    void *q;
+
+    if (p && b && (char *)p + old_size == b->data + b->used
+          && (size_t)((char *)p - b->data) + new_size <= b->size) {
+        b->used += new_size - old_size;
+        a->used += new_size - old_size;
+        return p;
+    }
+    q = arena_alloc(a, n);
+    if (p) {
+        memcpy(q, p, old < n ? old : n);
+    }
+    return q;
+}
+
+// everything handed out becomes invalid, the blocks are kept for reuse
+void arena_reset(struct arena_s *a) {
+    struct arena_block_s *b;
+
+    if (a->used > a->peak) {
+        a->peak = a->used;
+    }
+    STATS_PEAK(STAT_ARENA, a->used);
+    for (b = a->blocks; b; b = b->next) {
+        b->used = 0;
+    }
+    a->cur = NULL;
+    a->used = 0;
+}
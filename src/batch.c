@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuinfo.h"
+#include "dumpfile.h"
+#include "ingest.h"
+#include "arena.h"
+#include "outbuf.h"
+#include "xlat.h"
+#include "mmumap.h"
+#include "taskpool.h"
+#include "query.h"
+#include "json.h"
+#include "batch.h"
+#include "stats.h"
+
+/*
+Dumps are read in list order by the ingest code and handed to the task
+pool as they arrive, BATCH_JOBS at a time.  A register dump is one small
+task; its MMU map, if asked for, is split into per-L1-chunk tasks that
+idle workers steal.  Every task writes into its own output buffer, and
+the buffers are written out in list order once the batch is done, so
+the output does not depend on the number of workers.  The same goes for
+the translation index: each walk task indexes its own chunk, and the
+chunks are joined in VA order when the dump is written out.
+
+All of a task's results live in the arena of the worker that runs it,
+and the arenas are reset once the batch is written out; after the first
+batches have warmed them up, decoding makes no heap allocations.
+*/
+
+#define MAP_CHUNKS (MMUMAP_L1_ENTRIES / BATCH_MAP_CHUNK)
+
+struct dump_job_s;
+
+struct walk_chunk_s {
+    struct dump_job_s *job;
+    unsigned first;
+    struct outbuf_s out;
+    struct xlat_s index;
+};
+
+struct dump_job_s {
+    struct batch_s *b;
+    const char *path;
+    uint32_t buf[INGEST_BUF_SIZE / 4];  // copy of the file, unless it is mapped
+    struct dumpfile_s df;
+    int err;
+    int map_err;
+    struct mmumap_s map;
+    struct outbuf_s out;
+    struct json_s json;                 // open object in out, with --json
+    struct walk_chunk_s chunks[MAP_CHUNKS];
+};
+
+struct batch_s {
+    const struct batch_opts_s *opts;
+    struct taskpool_s *pool;
+    struct dump_job_s *jobs;
+    unsigned num_jobs;
+    struct arena_s *arenas;     // one per worker
+    int failed;
+    struct xlat_s index;        // of the dump being written out
+    struct outbuf_s out;
+    FILE *f;                    // where the batch goes
+};
+
+static int wants_index(const struct batch_opts_s *opts) {
+    return opts->regions || opts->translate || (opts->json && opts->map);
+}
+
+static int wants_map_text(const struct batch_opts_s *opts) {
+    return opts->map && !opts->json;
+}
+
+static void walk_task(void *arg, unsigned worker) {
+    struct walk_chunk_s *chunk = arg;
+    const struct batch_opts_s *opts = chunk->job->b->opts;
+    struct arena_s *arena = &chunk->job->b->arenas[worker];
+    STATS_TIMER(t);
+    outbuf_init_arena(&chunk->out, arena);
+    if (wants_map_text(opts)) {
+        mmumap_walk(&chunk->job->map, chunk->first, BATCH_MAP_CHUNK, &chunk->out);
+    }
+    if (wants_index(opts)) {
+        xlat_init_arena(&chunk->index, arena);
+        mmumap_index(&chunk->job->map, chunk->first, BATCH_MAP_CHUNK, &chunk->index);
+    }
+    STATS_STOP(STAT_WALK, t, chunk->out.len);
+}
+
+static int decode_json(struct dump_job_s *job) {
+    const struct batch_opts_s *opts = job->b->opts;
+    json_begin(&job->json, &job->out);
+    json_string(&job->json, "path", job->path);
+    json_string(&job->json, "layout", cpuinfo_layout_name(job->df.layout));
+    if (opts->tables_only) {
+        return 0;
+    }
+    if (opts->query) {
+        return query_format_json(opts->query, &job->json, job->df.words, job->df.layout);
+    }
+    return cpuinfo_format_json(&job->json, job->df.words, job->df.layout);
+}
+
+static void decode_task(void *arg, unsigned worker) {
+    struct dump_job_s *job = arg;
+    unsigned n;
+
+    outbuf_init_arena(&job->out, &job->b->arenas[worker]);
+    if (job->b->opts->json) {
+        if (decode_json(job) < 0) {
+            job->err = DUMPFILE_ERR_LAYOUT;
+            return;
+        }
+    }
+    else if (job->b->opts->tables_only) {
+        // the registers have been written by the caller
+    }
+    else if (job->b->opts->query) {
+        if (query_format(job->b->opts->query, &job->out, job->df.words, job->df.layout) < 0) {
+            job->err = DUMPFILE_ERR_LAYOUT;
+            return;
+        }
+    }
+    else if (cpuinfo_format(&job->out, job->df.words, job->df.layout) < 0) {
+        job->err = DUMPFILE_ERR_LAYOUT;
+        return;
+    }
+    if (!wants_map_text(job->b->opts) && !wants_index(job->b->opts)) {
+        return;
+    }
+    job->map_err = mmumap_init_vmsa(&job->map, &job->df);
+    job->map.syms = job->b->opts->symbols;
+    if (job->map_err == 0) {
+        for (n = 0; n < MAP_CHUNKS; n++) {
+            job->chunks[n].first = n * BATCH_MAP_CHUNK;
+            taskpool_submit(job->b->pool, walk_task, &job->chunks[n]);
+        }
+    }
+}
+
+// joins the chunk indexes of a dump in VA order
+static const struct xlat_s *job_index(struct batch_s *b, struct dump_job_s *job) {
+    unsigned n;
+    xlat_reset(&b->index);
+    for (n = 0; n < MAP_CHUNKS; n++) {
+        xlat_append(&b->index, &job->chunks[n].index);
+    }
+    b->index.mair[0] = job->map.mair[0];
+    b->index.mair[1] = job->map.mair[1];
+    b->index.remap = job->map.remap;
+    b->index.dacr = job->map.dacr;
+    return &b->index;
+}
+
+static size_t write_job(struct batch_s *b, struct dump_job_s *job) {
+    const struct batch_opts_s *opts = b->opts;
+    const struct xlat_s *index = NULL;
+    size_t bytes;
+    unsigned n;
+
+    if (job->map_err != 0) {
+        fprintf(stderr, "%s: MMU map: %s\n", job->path, mmumap_strerror(job->map_err));
+    }
+    else if (wants_index(opts)) {
+        index = job_index(b, job);
+    }
+    if (opts->json) {
+        if (index && (opts->regions || opts->map)) {
+            xlat_json_regions(index, opts->symbols, &job->json);
+        }
+        if (index && opts->translate) {
+            xlat_json_translation(index, opts->translate_va, opts->symbols, &job->json);
+        }
+        json_end(&job->json);
+        bytes = job->out.len;
+        outbuf_flush(&job->out, b->f);
+        return bytes;
+    }
+
+    if (opts->label) {
+        fprintf(b->f, "# %s\n", job->path);
+    }
+    if (index) {
+        if (opts->regions) {
+            xlat_print_regions(index, opts->symbols, &b->out);
+        }
+        if (opts->translate) {
+            xlat_print_translation(index, opts->translate_va, opts->symbols, &b->out);
+        }
+    }
+    bytes = job->out.len + b->out.len;
+    if (job->map_err == 0 && wants_map_text(opts)) {
+        // the map is megabytes in MAP_CHUNKS pieces: stitch them with writev, no copies
+        const char *head = opts->symbols ? csvhead_symbols : csvhead;
+        struct outbuf_s head_buf = { (char *)head, strlen(head), 0 };
+        struct outbuf_s *bufs[MAP_CHUNKS + 3];
+        unsigned num = 0;
+        bufs[num++] = &job->out;
+        bufs[num++] = &head_buf;
+        for (n = 0; n < MAP_CHUNKS; n++) {
+            bytes += job->chunks[n].out.len;
+            bufs[num++] = &job->chunks[n].out;
+        }
+        bufs[num++] = &b->out;
+        outbuf_flushv(bufs, num, b->f);
+        return bytes + strlen(head);
+    }
+    outbuf_flush(&job->out, b->f);
+    outbuf_flush(&b->out, b->f);
+    return bytes;
+}
+
+static void flush_batch(struct batch_s *b) {
+    unsigned i;
+    size_t bytes = 0;
+    taskpool_wait(b->pool);
+    STATS_TIMER(t);
+    for (i = 0; i < b->num_jobs; i++) {
+        struct dump_job_s *job = &b->jobs[i];
+        if (job->err == DUMPFILE_OK) {
+            job->err = dumpfile_error(&job->df); // images of a compressed file that failed to read or sum up
+        }
+        if (job->err != DUMPFILE_OK) {
+            fprintf(stderr, "%s: %s\n", job->path, dumpfile_strerror(job->err));
+            b->failed = 1;
+        }
+        else {
+            bytes += write_job(b, job);
+        }
+        // also after a failed decode or query: the dump was opened, its mapping must go
+        dumpfile_close(&job->df);
+    }
+    STATS_STOP(STAT_WRITE, t, bytes);
+    for (i = 0; i < taskpool_num_workers(b->pool); i++) {
+        arena_reset(&b->arenas[i]);
+    }
+    b->num_jobs = 0;
+}
+
+static void ingest_dump(void *ctx, size_t index, const char *path,
+                        const void *buf, size_t len, int status) {
+    struct batch_s *b = ctx;
+    struct dump_job_s *job = &b->jobs[b->num_jobs++];
+    (void)index;
+
+    job->path = path;
+    job->map_err = 0;
+    job->df.map = NULL;
+    job->df.lazy = NULL;
+    if (status < 0) {
+        job->err = DUMPFILE_ERR_IO;
+    }
+    else if (status == INGEST_PARTIAL || dumpfile_is_compressed(buf, len)) {
+        job->err = dumpfile_open(path, b->opts->raw_layout, &job->df); // too big for the ring, has images
+    }
+    else {
+        memcpy(job->buf, buf, len);
+        job->err = dumpfile_parse(job->buf, len, b->opts->raw_layout, &job->df);
+    }
+    if (job->err == DUMPFILE_OK) {
+        taskpool_submit(b->pool, decode_task, job);
+    }
+    if (b->num_jobs == BATCH_JOBS
+          || (b->num_jobs == BATCH_MAP_JOBS && (wants_map_text(b->opts) || wants_index(b->opts)))) {
+        flush_batch(b);
+    }
+}
+
+// workers, jobs and buffers stay allocated between batch_decode() calls
+struct batch_s *batch_create(const struct batch_opts_s *opts) {
+    struct batch_s *b = malloc(sizeof(*b));
+    unsigned i, n, workers = opts->workers ? opts->workers : taskpool_default_workers();
+
+    if (b == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+    b->opts = opts;
+    b->num_jobs = 0;
+    b->failed = 0;
+    b->f = stdout;
+    xlat_init(&b->index);
+    outbuf_init(&b->out);
+    b->jobs = malloc(BATCH_JOBS * sizeof(struct dump_job_s));
+    b->arenas = malloc(workers * sizeof(struct arena_s));
+    if (b->jobs == NULL || b->arenas == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        free(b->jobs);
+        free(b->arenas);
+        free(b);
+        return NULL;
+    }
+    b->pool = taskpool_create(workers);
+    for (i = 0; i < workers; i++) {
+        arena_init(&b->arenas[i]);
+    }
+    for (i = 0; i < BATCH_JOBS; i++) {
+        b->jobs[i].b = b;
+        for (n = 0; n < MAP_CHUNKS; n++) {
+            b->jobs[i].chunks[n].job = &b->jobs[i];
+        }
+    }
+    return b;
+}
+
+void batch_destroy(struct batch_s *b) {
+    unsigned i;
+    for (i = 0; i < taskpool_num_workers(b->pool); i++) {
+        arena_free(&b->arenas[i]);
+    }
+    taskpool_destroy(b->pool);
+    free(b->arenas);
+    free(b->jobs);
+    xlat_free(&b->index);
+    outbuf_free(&b->out);
+    free(b);
+}
+
+// decodes the list to f; -1 if any dump failed
+int batch_decode(struct batch_s *b, const struct ingest_list_s *list, FILE *f) {
+    b->f = f;
+    b->failed = 0;
+    ingest_files(list, b->opts->use_uring, ingest_dump, b);
+    flush_batch(b);
+    fflush(f);
+    return b->failed ? -1 : 0;
+}
+
+int batch_run(const struct batch_opts_s *opts, const struct ingest_list_s *list) {
+    struct batch_s *b = batch_create(opts);
+    int ret;
+    if (b == NULL) {
+        return -1;
+    }
+    ret = batch_decode(b, list, stdout);
+    batch_destroy(b);
+    return ret;
+}
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuinfo.h"
+#include "dumpfile.h"
+#include "ingest.h"
+#include "outbuf.h"
+#include "query.h"
+#include "json.h"
+#include "batch.h"
+#include "cluster.h"
+#include "stats.h"
+
+/*
+On SMP targets every core writes a dump of its own, and the dumps of one
+cluster differ in little besides the Multiprocessor ID: the cores run on
+the same tables and mostly have the same feature registers.  One pass
+over the list keeps the words of each dump; the dumps are then sorted
+into clusters by MPIDR Aff2:Aff1, and the cores of a cluster by Aff0.
+A cluster's registers are decoded once, from its lowest core, and every
+other core only lists the words it has different.  Cores whose MMU
+registers are the same share a table class, across clusters too: the
+clusters of a big.LITTLE part run one OS on the same tables.  Each class
+is walked once, with the cluster of its first core, from that core's
+dump; later clusters refer to it.
+*/
+
+// what mmumap_init_vmsa() reads; cores that agree on these walk the same tables
+static const char *mmu_words[] = { "TTBCR", "TTBR0", "TTBR1", "SCTLR", "PRRR", "NMRR", "DACR" };
+#define MMU_WORDS (sizeof(mmu_words) / sizeof(mmu_words[0]))
+
+#define MPIDR_CLUSTER(m)    ((m) & 0xffff00)    // Aff2, Aff1
+#define MPIDR_CORE(m)       ((m) & 0xff)        // Aff0
+
+struct cluster_core_s {
+    const char *path;
+    size_t index;                       // in the list, keeps the sort stable
+    unsigned layout;
+    unsigned num_words;
+    uint32_t words[CLUSTER_MAX_WORDS];
+    uint32_t mpidr;
+    size_t tables;                      // table class, the index of its first core in the sorted list
+};
+
+struct cluster_s {
+    const struct batch_opts_s *opts;
+    struct batch_opts_s table_opts;     // opts for walking the table classes
+    struct batch_s *batch;              // created for the first walk
+    struct cluster_core_s *cores;
+    size_t num, cap;
+    struct outbuf_s out;
+    int failed;
+};
+
+static int wants_tables(const struct batch_opts_s *opts) {
+    return opts->map || opts->regions || opts->translate;
+}
+
+static uint32_t word_of(const struct cluster_core_s *c, const char *name) {
+    int i = cpuinfo_word_index(c->layout, name);
+    return i >= 0 && (unsigned)i < c->num_words ? c->words[i] : 0;
+}
+
+static void ingest_dump(void *ctx, size_t index, const char *path,
+                        const void *buf, size_t len, int status) {
+    struct cluster_s *cl = ctx;
+    struct cluster_core_s *c;
+    struct dumpfile_s df;
+    int err;
+
+    df.map = NULL;
+    df.lazy = NULL;
+    if (status < 0) {
+        err = DUMPFILE_ERR_IO;
+    }
+    else if (status == INGEST_PARTIAL || dumpfile_is_compressed(buf, len)) {
+        err = dumpfile_open(path, cl->opts->raw_layout, &df);
+    }
+    else {
+        err = dumpfile_parse(buf, len, cl->opts->raw_layout, &df);
+    }
+    if (err == DUMPFILE_OK && cpuinfo_num_words(df.layout) > CLUSTER_MAX_WORDS) {
+        err = DUMPFILE_ERR_WORDS;
+    }
+    if (err != DUMPFILE_OK) {
+        fprintf(stderr, "%s: %s\n", path, dumpfile_strerror(err));
+        cl->failed = 1;
+        return;
+    }
+    if (cl->num == cl->cap) {
+        size_t cap = cl->cap ? 2 * cl->cap : 16;
+        c = realloc(cl->cores, cap * sizeof(*c));
+        if (c == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        cl->cores = c;
+        cl->cap = cap;
+    }
+    c = &cl->cores[cl->num++];
+    c->path = path;
+    c->index = index;
+    c->layout = df.layout;
+    c->num_words = cpuinfo_num_words(df.layout);
+    if (c->num_words > df.num_words) {
+        c->num_words = df.num_words;
+    }
+    memcpy(c->words, df.words, c->num_words * 4);
+    c->mpidr = word_of(c, "Multiprocessor ID");
+    dumpfile_close(&df);
+}
+
+static int core_cmp(const void *a, const void *b) {
+    const struct cluster_core_s *x = a, *y = b;
+    if (x->layout != y->layout) {
+        return x->layout < y->layout ? -1 : 1;
+    }
+    if (MPIDR_CLUSTER(x->mpidr) != MPIDR_CLUSTER(y->mpidr)) {
+        return MPIDR_CLUSTER(x->mpidr) < MPIDR_CLUSTER(y->mpidr) ? -1 : 1;
+    }
+    if (MPIDR_CORE(x->mpidr) != MPIDR_CORE(y->mpidr)) {
+        return MPIDR_CORE(x->mpidr) < MPIDR_CORE(y->mpidr) ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static int same_tables(const struct cluster_core_s *a, const struct cluster_core_s *b) {
+    unsigned n;
+    if (a->layout != b->layout) {
+        return 0;
+    }
+    for (n = 0; n < MMU_WORDS; n++) {
+        if (word_of(a, mmu_words[n]) != word_of(b, mmu_words[n])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// bit n: word n of c is not the same as in ref; the MPIDR always differs and is left out
+static uint64_t divergent(const struct cluster_core_s *ref, const struct cluster_core_s *c) {
+    int mpidr = cpuinfo_word_index(c->layout, "Multiprocessor ID");
+    uint64_t diff = 0;
+    unsigned n;
+    for (n = 0; n < c->num_words && n < ref->num_words; n++) {
+        if (c->words[n] != ref->words[n] && (int)n != mpidr) {
+            diff |= 1ULL << n;
+        }
+    }
+    return diff;
+}
+
+static void write_cluster_json(struct cluster_s *cl, const struct cluster_core_s *cores, size_t num) {
+    const struct cpuinfo_word_desc_s *desc = cpuinfo_get_desc(cores[0].layout);
+    struct json_s j;
+    size_t i;
+    unsigned n;
+
+    json_begin(&j, &cl->out);
+    json_uint(&j, "cluster", MPIDR_CLUSTER(cores[0].mpidr));
+    json_string(&j, "layout", cpuinfo_layout_name(cores[0].layout));
+    json_array(&j, "cores");
+    for (i = 0; i < num; i++) {
+        json_object(&j, NULL);
+        json_uint(&j, "core", MPIDR_CORE(cores[i].mpidr));
+        json_uint(&j, "mpidr", cores[i].mpidr);
+        json_string(&j, "path", cores[i].path);
+        if (cores[0].layout == CPUINFO_LAYOUT_VMSA) {
+            json_string(&j, "tables", cl->cores[cores[i].tables].path);
+        }
+        json_object_end(&j);
+    }
+    json_array_end(&j);
+    if (cl->opts->query) {
+        query_format_json(cl->opts->query, &j, cores[0].words, cores[0].layout);
+    }
+    else {
+        cpuinfo_format_json(&j, cores[0].words, cores[0].layout);
+    }
+    json_array(&j, "divergences");
+    for (i = 1; i < num; i++) {
+        uint64_t diff = divergent(&cores[0], &cores[i]);
+        if (diff == 0) {
+            continue;
+        }
+        json_object(&j, NULL);
+        json_uint(&j, "core", MPIDR_CORE(cores[i].mpidr));
+        json_string(&j, "path", cores[i].path);
+        json_array(&j, "words");
+        for (n = 0; n < cores[i].num_words; n++) {
+            if ((diff >> n) & 1) {
+                json_object(&j, NULL);
+                json_string(&j, "name", desc[n].name);
+                json_uint(&j, "value", cores[i].words[n]);
+                json_object_end(&j);
+            }
+        }
+        json_array_end(&j);
+        json_object_end(&j);
+    }
+    json_array_end(&j);
+    json_end(&j);
+}
+
+static void write_cluster_text(struct cluster_s *cl, const struct cluster_core_s *cores, size_t num) {
+    const struct cpuinfo_word_desc_s *desc = cpuinfo_get_desc(cores[0].layout);
+    struct outbuf_s *ob = &cl->out;
+    size_t i, k;
+    unsigned n, num_diff;
+
+    outbuf_printf(ob, "# cluster 0x%06X, %s: %zu core%s\n", MPIDR_CLUSTER(cores[0].mpidr),
+                  cpuinfo_layout_name(cores[0].layout), num, num == 1 ? "" : "s");
+    for (i = 0; i < num; i++) {
+        outbuf_printf(ob, "# core %u, MPIDR 0x%08X: %s\n", MPIDR_CORE(cores[i].mpidr),
+                      cores[i].mpidr, cores[i].path);
+    }
+    if (cl->opts->query) {
+        query_format(cl->opts->query, ob, cores[0].words, cores[0].layout);
+    }
+    else {
+        cpuinfo_format(ob, cores[0].words, cores[0].layout);
+    }
+    for (i = 1; i < num; i++) {
+        uint64_t diff = divergent(&cores[0], &cores[i]);
+        num_diff = __builtin_popcountll(diff);
+        if (num_diff == 0) {
+            outbuf_printf(ob, "# core %u: registers as core %u\n", MPIDR_CORE(cores[i].mpidr),
+                          MPIDR_CORE(cores[0].mpidr));
+            continue;
+        }
+        outbuf_printf(ob, "# core %u: %u register%s differ%s from core %u\n", MPIDR_CORE(cores[i].mpidr),
+                      num_diff, num_diff == 1 ? "" : "s", num_diff == 1 ? "s" : "", MPIDR_CORE(cores[0].mpidr));
+        for (n = 0; n < cores[i].num_words; n++) {
+            if ((diff >> n) & 1) {
+                outbuf_printf(ob, "%s 0x%08X\n", desc[n].name, cores[i].words[n]);
+            }
+        }
+    }
+    // one line per table class, at the first core of the cluster that has it
+    for (i = 0; i < num && cores[0].layout == CPUINFO_LAYOUT_VMSA; i++) {
+        const struct cluster_core_s *first = &cl->cores[cores[i].tables];
+        for (k = 0; k < i && cores[k].tables != cores[i].tables; k++) {
+        }
+        if (k < i) {
+            continue;
+        }
+        outbuf_puts(ob, "# tables of cores");
+        for (k = i; k < num; k++) {
+            if (cores[k].tables == cores[i].tables) {
+                outbuf_printf(ob, "%s %u", k == i ? "" : ",", MPIDR_CORE(cores[k].mpidr));
+            }
+        }
+        if (first < cores) {
+            outbuf_printf(ob, ": %s, walked with cluster 0x%06X\n", first->path, MPIDR_CLUSTER(first->mpidr));
+        }
+        else {
+            outbuf_printf(ob, ": %s\n", first->path);
+        }
+    }
+}
+
+// decodes and compares the cores [0, num) of one cluster, and walks the table classes first seen in it
+static void write_cluster(struct cluster_s *cl, struct cluster_core_s *cores, size_t num) {
+    struct ingest_list_s walks = {};
+    size_t i, base = cores - cl->cores;
+
+    STATS_TIMER(t);
+    if (cl->opts->json) {
+        write_cluster_json(cl, cores, num);
+    }
+    else {
+        write_cluster_text(cl, cores, num);
+    }
+    STATS_STOP(STAT_DECODE, t, cl->out.len);
+    outbuf_flush(&cl->out, stdout);
+
+    if (!wants_tables(cl->opts) || cores[0].layout != CPUINFO_LAYOUT_VMSA) {
+        return;
+    }
+    for (i = 0; i < num; i++) {
+        if (cores[i].tables == base + i && ingest_list_add(&walks, cores[i].path) < 0) {
+            fprintf(stderr, "Cannot list %s\n", cores[i].path);
+            cl->failed = 1;
+        }
+    }
+    if (cl->batch == NULL) {
+        cl->batch = batch_create(&cl->table_opts);
+        if (cl->batch == NULL) {
+            exit(-1);
+        }
+    }
+    if (batch_decode(cl->batch, &walks, stdout) < 0) {
+        cl->failed = 1;
+    }
+    ingest_list_free(&walks);
+}
+
+// table classes over all clusters, the first core of each in list order after the sort
+static void assign_tables(struct cluster_s *cl) {
+    size_t i, k;
+    for (i = 0; i < cl->num; i++) {
+        cl->cores[i].tables = i;
+        for (k = 0; k < i; k++) {
+            if (cl->cores[k].tables == k && same_tables(&cl->cores[k], &cl->cores[i])) {
+                cl->cores[i].tables = k;
+                break;
+            }
+        }
+    }
+}
+
+int cluster_run(const struct batch_opts_s *opts, const struct ingest_list_s *list) {
+    struct cluster_s cl;
+    size_t first, end;
+
+    memset(&cl, 0, sizeof(cl));
+    cl.opts = opts;
+    cl.table_opts = *opts;
+    cl.table_opts.tables_only = 1;
+    cl.table_opts.label = 1;
+    outbuf_init(&cl.out);
+
+    ingest_files(list, opts->use_uring, ingest_dump, &cl);
+    qsort(cl.cores, cl.num, sizeof(*cl.cores), core_cmp);
+    assign_tables(&cl);
+    for (first = 0; first < cl.num; first = end) {
+        for (end = first + 1; end < cl.num && cl.cores[end].layout == cl.cores[first].layout
+               && MPIDR_CLUSTER(cl.cores[end].mpidr) == MPIDR_CLUSTER(cl.cores[first].mpidr); end++) {
+        }
+        write_cluster(&cl, &cl.cores[first], end - first);
+    }
+    fflush(stdout);
+
+    if (cl.batch) {
+        batch_destroy(cl.batch);
+    }
+    outbuf_free(&cl.out);
+    free(cl.cores);
+    return cl.failed ? -1 : 0;
+}
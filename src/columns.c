@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuinfo.h"
+#include "dumpfile.h"
+#include "ingest.h"
+#include "outbuf.h"
+#include "query.h"
+#include "json.h"
+#include "batch.h"
+#include "columns.h"
+#include "stats.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define COLUMNS_X86
+#endif
+
+/*
+Over a corpus every dump gets the same shift and mask per query field,
+so dumps are not decoded one by one: they are transposed into blocks of
+COLUMNS_LANES dumps per layout, one row of lanes per register word, and
+each field is cut out of a whole row at once, 16 dumps per AVX-512 or 8
+per AVX2 instruction, or a plain loop on CPUs without either.  The
+results land in one column per field, in list order, which the
+histograms and the CSV export then read.
+*/
+
+struct block_s {
+    uint32_t words[COLUMNS_MAX_WORDS][COLUMNS_LANES];   // word-major
+    unsigned num_words[COLUMNS_LANES];
+    size_t index[COLUMNS_LANES];                         // of each lane's dump in the list
+    unsigned num;
+};
+
+struct columns_s {
+    const struct batch_opts_s *opts;
+    const struct query_s *q;
+    const struct ingest_list_s *list;
+    struct block_s blocks[CPUINFO_LAYOUT_V5 + 1];      // one filling up per layout
+    uint32_t *cols;                 // field n of dump i at cols[n * list->num + i]
+    uint64_t *present;              // bit n: dump has field n
+    uint8_t *layout;                // CPUINFO_LAYOUT_UNKNOWN: dump not read
+    size_t num_dumps;
+    int failed;
+};
+
+typedef void (*extract_fn)(const uint32_t *in, uint32_t *out, unsigned shift, uint32_t mask);
+
+static void extract_scalar(const uint32_t *in, uint32_t *out, unsigned shift, uint32_t mask) {
+    unsigned n;
+    for (n = 0; n < COLUMNS_LANES; n++) {
+        out[n] = (in[n] >> shift) & mask;
+    }
+}
+
+#ifdef COLUMNS_X86
+__attribute__((target("avx2")))
+static void extract_avx2(const uint32_t *in, uint32_t *out, unsigned shift, uint32_t mask) {
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m256i m = _mm256_set1_epi32(mask);
+    unsigned n;
+    for (n = 0; n < COLUMNS_LANES; n += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + n));
+        _mm256_storeu_si256((__m256i *)(out + n), _mm256_and_si256(_mm256_srl_epi32(v, count), m));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void extract_avx512(const uint32_t *in, uint32_t *out, unsigned shift, uint32_t mask) {
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m512i v = _mm512_loadu_si512(in);
+    _mm512_storeu_si512(out, _mm512_and_si512(_mm512_srl_epi32(v, count), _mm512_set1_epi32(mask)));
+}
+#endif
+
+static extract_fn pick_extract(void) {
+#ifdef COLUMNS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return extract_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return extract_avx2;
+    }
+#endif
+    return extract_scalar;
+}
+
+static extract_fn extract;
+
+// cuts every query field out of the block's rows into the columns
+static void flush_block(struct columns_s *c, unsigned layout) {
+    struct block_s *b = &c->blocks[layout];
+    size_t num = c->list->num;
+    uint32_t out[COLUMNS_LANES];
+    unsigned n, lane;
+    STATS_TIMER(t);
+
+    if (b->num == 0) {
+        return;
+    }
+    for (lane = 0; lane < b->num; lane++) {
+        c->present[b->index[lane]] = 0;
+    }
+    for (n = 0; n < c->q->num; n++) {
+        const struct query_field_s *qf = &c->q->fields[layout][n];
+        uint32_t *col = c->cols + n * num;
+        if (qf->word < 0) {
+            continue;
+        }
+        extract(b->words[qf->word], out, qf->shift, qf->bits < 32 ? ~(0xFFFFFFFF << qf->bits) : 0xFFFFFFFF);
+        for (lane = 0; lane < b->num; lane++) {
+            col[b->index[lane]] = out[lane];
+            if ((unsigned)qf->word < b->num_words[lane]) {
+                c->present[b->index[lane]] |= 1ULL << n;
+            }
+        }
+    }
+    STATS_STOP(STAT_DECODE, t, b->num * c->q->num * 4);
+    b->num = 0;
+}
+
+static void add_dump(struct columns_s *c, size_t index, const struct dumpfile_s *df) {
+    struct block_s *b = &c->blocks[df->layout];
+    unsigned lane = b->num++;
+    unsigned num = cpuinfo_num_words(df->layout);
+    unsigned w;
+
+    if (num > df->num_words) {
+        num = df->num_words;
+    }
+    for (w = 0; w < num; w++) {
+        b->words[w][lane] = df->words[w];
+    }
+    for (; w < COLUMNS_MAX_WORDS; w++) {
+        b->words[w][lane] = 0;
+    }
+    b->num_words[lane] = num;
+    b->index[lane] = index;
+    c->layout[index] = df->layout;
+    c->num_dumps++;
+    if (b->num == COLUMNS_LANES) {
+        flush_block(c, df->layout);
+    }
+}
+
+static void ingest_dump(void *ctx, size_t index, const char *path,
+                        const void *buf, size_t len, int status) {
+    struct columns_s *c = ctx;
+    struct dumpfile_s df;
+    int err;
+
+    df.map = NULL;
+    df.lazy = NULL;
+    if (status < 0) {
+        err = DUMPFILE_ERR_IO;
+    }
+    else if (status == INGEST_PARTIAL || dumpfile_is_compressed(buf, len)) {
+        err = dumpfile_open(path, c->opts->raw_layout, &df);
+    }
+    else {
+        err = dumpfile_parse(buf, len, c->opts->raw_layout, &df);
+    }
+    if (err == DUMPFILE_OK && cpuinfo_num_words(df.layout) > COLUMNS_MAX_WORDS) {
+        err = DUMPFILE_ERR_WORDS;
+    }
+    if (err != DUMPFILE_OK) {
+        fprintf(stderr, "%s: %s\n", path, dumpfile_strerror(err));
+        c->failed = 1;
+        return;
+    }
+    add_dump(c, index, &df);
+    dumpfile_close(&df);
+}
+
+// field n as resolved in the first layout that has it, for the value descriptions
+static const struct query_field_s *field_of(const struct query_s *q, unsigned n) {
+    unsigned layout;
+    for (layout = 0; layout <= CPUINFO_LAYOUT_V5; layout++) {
+        if (q->fields[layout][n].word >= 0) {
+            return &q->fields[layout][n];
+        }
+    }
+    return NULL;
+}
+
+struct hist_bin_s {
+    uint32_t value;
+    size_t count;
+};
+
+static int cmp_value(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// most frequent first, ties by value
+static int cmp_bin(const void *a, const void *b) {
+    const struct hist_bin_s *x = a, *y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->value < y->value ? -1 : x->value > y->value;
+}
+
+// bins of column n, sorted; returns their number, *missing counts dumps without the field
+static unsigned histogram(const struct columns_s *c, unsigned n, uint32_t *vals,
+                          struct hist_bin_s *bins, size_t *missing) {
+    const uint32_t *col = c->cols + n * c->list->num;
+    size_t i, num = 0;
+    unsigned num_bins = 0;
+
+    *missing = 0;
+    for (i = 0; i < c->list->num; i++) {
+        if (c->layout[i] == CPUINFO_LAYOUT_UNKNOWN) {
+            continue;
+        }
+        if ((c->present[i] >> n) & 1) {
+            vals[num++] = col[i];
+        }
+        else {
+            (*missing)++;
+        }
+    }
+    qsort(vals, num, sizeof(*vals), cmp_value);
+    for (i = 0; i < num; i++) {
+        if (num_bins == 0 || bins[num_bins - 1].value != vals[i]) {
+            bins[num_bins].value = vals[i];
+            bins[num_bins++].count = 0;
+        }
+        bins[num_bins - 1].count++;
+    }
+    qsort(bins, num_bins, sizeof(*bins), cmp_bin);
+    return num_bins;
+}
+
+static void write_hist(const struct columns_s *c, unsigned n, const struct hist_bin_s *bins,
+                       unsigned num_bins, size_t missing, struct outbuf_s *ob) {
+    const struct query_field_s *qf = field_of(c->q, n);
+    const char *path = c->q->paths[n];
+    struct json_s j;
+    unsigned i;
+
+    if (c->opts->json) {
+        json_begin(&j, ob);
+        json_string(&j, "path", path);
+        json_uint(&j, "missing", missing);
+        json_array(&j, "values");
+        for (i = 0; i < num_bins; i++) {
+            json_object(&j, NULL);
+            json_uint(&j, "value", bins[i].value);
+            json_uint(&j, "count", bins[i].count);
+            if (qf && qf->field && qf->field->desc_fn) {
+                json_string(&j, "desc", qf->field->desc_fn(bins[i].value));
+            }
+            json_object_end(&j);
+        }
+        json_array_end(&j);
+        json_end(&j);
+        return;
+    }
+    outbuf_printf(ob, "# %s: %u values\n", path, num_bins);
+    for (i = 0; i < num_bins; i++) {
+        unsigned val = bins[i].value;
+        if (qf == NULL || qf->field == NULL) {
+            outbuf_printf(ob, "%10zu 0x%08X\n", bins[i].count, val);
+        }
+        else if (qf->field->desc_fn) {
+            outbuf_printf(ob, "%10zu 0x%X %d [%s]\n", bins[i].count, val, val, qf->field->desc_fn(val));
+        }
+        else {
+            outbuf_printf(ob, "%10zu 0x%X %d\n", bins[i].count, val, val);
+        }
+    }
+    if (missing) {
+        outbuf_printf(ob, "%10zu -\n", missing);
+    }
+}
+
+static void write_hists(const struct columns_s *c, struct outbuf_s *ob) {
+    uint32_t *vals = malloc((c->num_dumps + 1) * sizeof(*vals));
+    struct hist_bin_s *bins = malloc((c->num_dumps + 1) * sizeof(*bins));
+    size_t missing;
+    unsigned n, num_bins;
+
+    if (vals == NULL || bins == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    if (!c->opts->json) {
+        outbuf_printf(ob, "# %zu dumps\n", c->num_dumps);
+    }
+    for (n = 0; n < c->q->num; n++) {
+        num_bins = histogram(c, n, vals, bins, &missing);
+        write_hist(c, n, bins, num_bins, missing, ob);
+    }
+    free(vals);
+    free(bins);
+}
+
+// one row per dump that was read, in list order; fields the dump hasn't got stay empty
+static void write_csv(const struct columns_s *c, struct outbuf_s *ob) {
+    size_t i, num = c->list->num;
+    unsigned n;
+
+    outbuf_puts(ob, "Path,Layout");
+    for (n = 0; n < c->q->num; n++) {
+        outbuf_puts(ob, ",");
+        outbuf_csv_cell(ob, c->q->paths[n]);
+    }
+    outbuf_puts(ob, "\n");
+    for (i = 0; i < num; i++) {
+        if (c->layout[i] == CPUINFO_LAYOUT_UNKNOWN) {
+            continue;
+        }
+        outbuf_csv_cell(ob, c->list->paths[i]);
+        outbuf_printf(ob, ",%s", cpuinfo_layout_name(c->layout[i]));
+        for (n = 0; n < c->q->num; n++) {
+            if ((c->present[i] >> n) & 1) {
+                outbuf_printf(ob, ",0x%X", c->cols[n * num + i]);
+            }
+            else {
+                outbuf_puts(ob, ",");
+            }
+        }
+        outbuf_puts(ob, "\n");
+    }
+}
+
+int columns_run(const struct batch_opts_s *opts, const struct ingest_list_s *list, int mode) {
+    struct columns_s *c;
+    struct outbuf_s ob;
+    unsigned layout;
+    int failed;
+
+    if (opts->query == NULL) {
+        return -1;
+    }
+    if (extract == NULL) {
+        extract = pick_extract();
+    }
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    c->opts = opts;
+    c->q = opts->query;
+    c->list = list;
+    c->cols = malloc((list->num * c->q->num + 1) * sizeof(*c->cols));
+    c->present = calloc(list->num + 1, sizeof(*c->present));
+    c->layout = calloc(list->num + 1, 1);
+    if (c->cols == NULL || c->present == NULL || c->layout == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+
+    ingest_files(list, opts->use_uring, ingest_dump, c);
+    for (layout = 0; layout <= CPUINFO_LAYOUT_V5; layout++) {
+        flush_block(c, layout);
+    }
+
+    outbuf_init(&ob);
+    STATS_TIMER(t);
+    if (mode == COLUMNS_CSV) {
+        write_csv(c, &ob);
+    }
+    else {
+        write_hists(c, &ob);
+    }
+    STATS_STOP(STAT_WRITE, t, ob.len);
+    outbuf_flush(&ob, stdout);
+    fflush(stdout);
+    outbuf_free(&ob);
+
+    failed = c->failed;
+    free(c->cols);
+    free(c->present);
+    free(c->layout);
+    free(c);
+    return failed ? -1 : 0;
+}
@@ -1,6 +1,8 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 /*
 This is all based on CHDK cpuinfo module, made to work standalone on Linux.
@@ -12,6 +14,9 @@ Their code is GPL 2 so this code probably is as well.
 */
 
 #include "cpuinfo.h"
+#include "outbuf.h"
+#include "json.h"
+#include "stats.h"
 
 const struct cpuinfo_bitfield_desc_s cpuinf_id[] = {
     {4,"Revision"},
@@ -41,7 +46,7 @@ static const char *regperm_str(unsigned val) {
     }
 }
 
-static char linebuf[256]; // fixed buffer for outputting dynamic strings from interpreter functions
+static __thread char linebuf[256]; // fixed buffer for outputting dynamic strings from interpreter functions, one per decoding thread
 
 static const char *two_nth_str[] = {
 "1", "2", "4", "8", "16", "32", "64", "128", "256", "512", "1K", "2K", "4K", "8K", "16K", "32K"
@@ -701,6 +706,31 @@ const struct cpuinfo_bitfield_desc_s cpuinf_ttbr1[] = {
     {}
 };
 
+static const char *dacr_domain(unsigned val) {
+    static const char *types[] = { "No access", "Client", "rsrvd", "Manager" };
+    return types[val & 3];
+}
+
+const struct cpuinfo_bitfield_desc_s cpuinf_dacr[] = {
+    {2,"D0", dacr_domain },
+    {2,"D1", dacr_domain },
+    {2,"D2", dacr_domain },
+    {2,"D3", dacr_domain },
+    {2,"D4", dacr_domain },
+    {2,"D5", dacr_domain },
+    {2,"D6", dacr_domain },
+    {2,"D7", dacr_domain },
+    {2,"D8", dacr_domain },
+    {2,"D9", dacr_domain },
+    {2,"D10", dacr_domain },
+    {2,"D11", dacr_domain },
+    {2,"D12", dacr_domain },
+    {2,"D13", dacr_domain },
+    {2,"D14", dacr_domain },
+    {2,"D15", dacr_domain },
+    {}
+};
+
 const struct cpuinfo_bitfield_desc_s cpuinf_actlr_vmsa[] = {
     {1,"Cache & TLB maint. broadcast" },
     {1,"L2 prefetch enable" },
@@ -756,7 +786,7 @@ const struct cpuinfo_word_desc_s cpuinfo_desc_vmsa[]={
     {"ACTLR", cpuinf_actlr_vmsa },
     {"ACTLR2", cpuinf_generic },
     {"CPACR", cpuinf_cpacr_vmsa },
-    {"DACR", cpuinf_generic },
+    {"DACR", cpuinf_dacr },
     //{"ATCM region reg", cpuinf_tcmreg }, // not specified in Cortex A literature
     //{"BTCM region reg", cpuinf_tcmreg }, // not specified in Cortex A literature
     {"NSACR (sec. ext. only)", cpuinf_generic },
@@ -795,7 +825,95 @@ char *cpolicies[] = {
     "Cached OUTER 3 INNER 3",
 };
 
-unsigned interpret_l1_table_entry(unsigned e, char *buf) {
+static char *accperms[] = {
+    "--/--", "RW/--", "RW/R-", "RW/RW", "rsrvd", "R-/--", "R-/R-", "rsrvd",
+};
+
+// privileged/unprivileged access of the APX:AP[1:0] bits of a short descriptor
+char *cpuinfo_accperm(unsigned apx_ap) {
+    return accperms[apx_ap & 7];
+}
+
+static char *noaccperms[] = {
+    "--/--", "--/--", "--/--", "--/--", "--/--", "--/--", "--/--", "--/--",
+};
+
+static char *managerperms[] = {
+    "RW/RW", "RW/RW", "RW/RW", "RW/RW", "RW/RW", "RW/RW", "RW/RW", "RW/RW",
+};
+
+static char *rsrvdperms[] = {
+    "rsrvd", "rsrvd", "rsrvd", "rsrvd", "rsrvd", "rsrvd", "rsrvd", "rsrvd",
+};
+
+// DACR: clients are checked against the AP bits, managers never are
+void cpuinfo_dacr_init(struct cpuinfo_dacr_s *d, uint32_t dacr) {
+    static char **perms[] = { noaccperms, accperms, rsrvdperms, managerperms };
+    unsigned n;
+    for (n = 0; n < 16; n++) {
+        d->type[n] = (dacr >> (2 * n)) & 3;
+        d->perms[n] = perms[d->type[n]];
+    }
+}
+
+const char *cpuinfo_domain_type(const struct cpuinfo_dacr_s *d, unsigned domain) {
+    return dacr_domain(d->type[domain & 15]);
+}
+
+// access of APX:AP[1:0] in domain, after the domain's DACR type
+char *cpuinfo_effperm(const struct cpuinfo_dacr_s *d, unsigned domain, unsigned apx_ap) {
+    return d->perms[domain & 15][apx_ap & 7];
+}
+
+// caching and memory type of TEX[2:0], C and B, at their section entry positions
+// (bits 14..12, 3 and 2); reserved encodings leave both untouched
+void cpuinfo_texcb(unsigned f, char **caching, char **memtype) {
+    switch (f & 0x700c) {
+      case 0: *caching = "STR ORD"; *memtype = "Strongly-ordered"; break;
+      case 4: *caching = "SHR DEV"; *memtype = "Device"; break;
+      case 8: *caching = "WRTHR, NAW"; *memtype = "Normal"; break;
+      case 0xc: *caching = "WRBCK, NAW"; *memtype = "Normal"; break;
+      case 0x1000: *caching = "NON CACH"; *memtype = "Normal"; break;
+      case 0x2000: *caching = "NONSHR DEV"; *memtype = "Device"; break;
+      default:
+          if (f & 0x4000) {
+              unsigned i = ((f&0x3000)>>10)|((f&0xc)>>2);
+              *caching = cpolicies[i];
+              *memtype = "Normal";
+          }
+    }
+}
+
+// PRRR TRn: 0 strongly-ordered, 1 device, 2 normal with NMRR IRn/ORn, which
+// encode like TEX[1:0] and C:B of the TEX=1xx cached types; 3 is reserved
+void cpuinfo_remap_init(struct cpuinfo_remap_s *r, uint32_t sctlr, uint32_t prrr, uint32_t nmrr) {
+    unsigned n;
+    r->tre = (sctlr >> 28) & 1;
+    for (n = 0; n < 8; n++) {
+        switch ((prrr >> (2 * n)) & 3) {
+            case 0: r->caching[n] = "STR ORD"; r->memtype[n] = "Strongly-ordered"; break;
+            case 1: r->caching[n] = "DEV"; r->memtype[n] = "Device"; break;
+            case 2:
+                r->caching[n] = cpolicies[(((nmrr >> (16 + 2 * n)) & 3) << 2) | ((nmrr >> (2 * n)) & 3)];
+                r->memtype[n] = "Normal";
+                break;
+            default: r->caching[n] = "rsrvd"; r->memtype[n] = ""; break;
+        }
+    }
+}
+
+// cpuinfo_texcb(), or the remapped type when remap is given and has TRE set
+void cpuinfo_memattr(unsigned f, const struct cpuinfo_remap_s *remap, char **caching, char **memtype) {
+    if (remap && remap->tre) {
+        unsigned i = ((f >> 10) & 4) | ((f >> 2) & 3);
+        *caching = remap->caching[i];
+        *memtype = remap->memtype[i];
+        return;
+    }
+    cpuinfo_texcb(f, caching, memtype);
+}
+
+unsigned interpret_l1_table_entry(unsigned e, const struct cpuinfo_remap_s *remap, char *buf) {
     unsigned ret = 0, l2a = 0;
     struct l1tblentry_s col;
     col.typ = "";
@@ -835,30 +953,8 @@ unsigned interpret_l1_table_entry(unsigned e, char *buf) {
         col.ngbit = e&0x20000?"Nonglobal":"Global";
         col.sbit = e&0x10000?"Shareable":"";
         col.xnbit = e&0x10?"No exec":"";
-        switch (e & 0x8C00) {
-            case 0: col.accperm = "--/--"; break;
-            case 0x400: col.accperm = "RW/--"; break;
-            case 0x800: col.accperm = "RW/R-"; break;
-            case 0xC00: col.accperm = "RW/RW"; break;
-            case 0x8000: col.accperm = "rsrvd"; break;
-            case 0x8400: col.accperm = "R-/--"; break;
-            case 0x8800: col.accperm = "R-/R-"; break;
-            case 0x8C00: col.accperm = "rsrvd"; break;
-        }
-        switch (e & 0x700c) {
-          case 0: col.caching = "STR ORD"; col.memtype = "Strongly-ordered"; break;
-          case 4: col.caching = "SHR DEV"; col.memtype = "Device"; break;
-          case 8: col.caching = "WRTHR, NAW"; col.memtype = "Normal"; break;
-          case 0xc: col.caching = "WRBCK, NAW"; col.memtype = "Normal"; break;
-          case 0x1000: col.caching = "NON CACH"; col.memtype = "Normal"; break;
-          case 0x2000: col.caching = "NONSHR DEV"; col.memtype = "Device"; break;
-          default:
-              if (e & 0x4000) {
-                  unsigned i = ((e&0x3000)>>10)|((e&0xc)>>2);
-                  col.caching = cpolicies[i];
-                  col.memtype = "Normal";
-              }
-        }
+        col.accperm = cpuinfo_accperm(((e >> 13) & 4) | ((e >> 10) & 3));
+        cpuinfo_memattr(e, remap, &col.caching, &col.memtype);
     }
     sprintf(buf,"%s,%s,%s,%u,%s,%s,%s,%s,%s,%s,%s,",col.typ,col.pbit,
             col.ngbit,col.domain,col.physaddr,col.l2addr,col.sbit,col.accperm,
@@ -872,7 +968,7 @@ unsigned interpret_l1_table_entry(unsigned e, char *buf) {
     return ret;
 }
 
-unsigned interpret_l2_table_entry(unsigned e, char *buf) {
+unsigned interpret_l2_table_entry(unsigned e, const struct cpuinfo_remap_s *remap, char *buf) {
     unsigned ret = 0, f;
     struct l1tblentry_s col;
     col.typ = "";
@@ -908,30 +1004,8 @@ unsigned interpret_l2_table_entry(unsigned e, char *buf) {
     }
     col.ngbit = e&0x800?"Nonglobal":"Global";
     col.sbit = e&0x400?"Shareable":"";
-    switch ((e<<6) & 0x8C00) {
-        case 0: col.accperm = "--/--"; break;
-        case 0x400: col.accperm = "RW/--"; break;
-        case 0x800: col.accperm = "RW/R-"; break;
-        case 0xC00: col.accperm = "RW/RW"; break;
-        case 0x8000: col.accperm = "rsrvd"; break;
-        case 0x8400: col.accperm = "R-/--"; break;
-        case 0x8800: col.accperm = "R-/R-"; break;
-        case 0x8C00: col.accperm = "rsrvd"; break;
-    }
-    switch (f & 0x700c) {
-      case 0: col.caching = "STR ORD"; col.memtype = "Strongly-ordered"; break;
-      case 4: col.caching = "SHR DEV"; col.memtype = "Device"; break;
-      case 8: col.caching = "WRTHR, NAW"; col.memtype = "Normal"; break;
-      case 0xc: col.caching = "WRBCK, NAW"; col.memtype = "Normal"; break;
-      case 0x1000: col.caching = "NON CACH"; col.memtype = "Normal"; break;
-      case 0x2000: col.caching = "NONSHR DEV"; col.memtype = "Device"; break;
-      default:
-          if (f & 0x4000) {
-              unsigned i = ((f&0x3000)>>10)|((f&0xc)>>2);
-              col.caching = cpolicies[i];
-              col.memtype = "Normal";
-          }
-    }
+    col.accperm = cpuinfo_accperm(((e >> 7) & 4) | ((e >> 4) & 3));
+    cpuinfo_memattr(f, remap, &col.caching, &col.memtype);
     sprintf(buf,"%s,%s,%s,,%s,%s,%s,%s,%s,%s,%s,",col.typ,col.pbit,
             col.ngbit,col.physaddr,col.l2addr,col.sbit,col.accperm,
             col.caching,col.memtype,col.xnbit);
@@ -941,97 +1015,8 @@ unsigned interpret_l2_table_entry(unsigned e, char *buf) {
     return ret;
 }
 
-const char *csvhead = "Virt.addr,Table,Type,P bit,NG bit,Domain,Phys.addr,L2 ref,S bit,Privileged/Nonpriv.,Caching,Memtype,XN bit\n";
-
-// this uses get_mmuregs_vmsa(), which is inline asm.  Disabling for now,
-// may not be needed at all.
-/*
-void memmapping_vmsa(FILE *f) {
-    struct mmuregs_s mmuregs;
-    get_mmuregs_vmsa(&mmuregs);
-    unsigned tt0len = 128 << (7 - (mmuregs.ttbcr & 7));
-    unsigned tt0adr = mmuregs.ttbr0 & 0xffffff80;
-    unsigned tt1adr = mmuregs.ttbr1 & 0xffffff80;
-    unsigned n, *e, r, pr=42, cycl, l1a;
-    char *conclude;
-    e = (unsigned*)tt0adr;
-    cycl = tt0len/4;
-    l1a = 0;
-    unsigned remain = 2;
-    fwrite(csvhead,1,strlen(csvhead),f);
-    while (remain) {
-        for (n=0; n<cycl; n++) {
-            sprintf(linebuf,"0x%08X,L1,",l1a); // virtual address to be described by L1 entry
-            fwrite(linebuf,1,strlen(linebuf),f);
-            conclude = "\n";
-            r = interpret_l1_table_entry(*e, linebuf);
-            fwrite(linebuf,1,strlen(linebuf),f);
-            if (r==1 && pr!=1) { // supersection begins
-                if ((unsigned)e & 0x3f) {
-                    conclude = "ERR: Unaligned supersection\n";
-                }
-                else {
-                    unsigned m, v;
-                    v = *e;
-                    for (m=1; m<16; m++) {
-                        if (v != *(e+m)) {
-                            conclude = "ERR: Inconsistent supersection\n";
-                            break;
-                        }
-                    }
-                }
-            }
-            else if (r==2) {
-                conclude = "\n";
-            }
-            fwrite(conclude,1,strlen(conclude),f);
-            if (r>42) { // interpret L2 table
-                unsigned nn, l2a, *ee, rr, prr=42;
-                l2a = l1a;
-                ee = (unsigned*) r;
-                for (nn=0; nn<256; nn++) {
-                    sprintf(linebuf,"0x%08X,L2,",l2a); // virtual address to be described by L2 entry
-                    fwrite(linebuf,1,strlen(linebuf),f);
-                    conclude = "\n";
-                    rr = interpret_l2_table_entry(*ee, linebuf);
-                    fwrite(linebuf,1,strlen(linebuf),f);
-                    
-                    if (rr==1 && prr!=1) { // large page begins
-                        if ((unsigned)ee & 0x3f) {
-                            conclude = "ERR: Unaligned large page\n";
-                        }
-                        else {
-                            unsigned mm, vv;
-                            vv = *ee;
-                            for (mm=1; mm<16; mm++) {
-                                if (vv != *(ee+mm)) {
-                                    conclude = "ERR: Inconsistent large page\n";
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    else if (rr==2) {
-                        conclude = "\n";
-                    }
-                    fwrite(conclude,1,strlen(conclude),f);
-                    
-                    ee++;
-                    prr = rr;
-                    l2a += 0x1000;
-                }
-            }
-            e++;
-            pr = r;
-            l1a += 0x100000;
-        }
-        e = (unsigned*)(tt1adr+tt0len);
-        cycl = (0x4000 - tt0len) / 4;
-        remain--;
-    }
-    fclose(f);
-}
-*/
+// the MMU map walker, memmapping_vmsa() in CHDK, lives in mmumap.c and
+// reads the tables from the RAM images in a dump container
 
 uint32_t get_num_cpuinfo_words()
 {
@@ -1049,19 +1034,264 @@ uint32_t get_num_cpuinfo_words()
     // sizeof(cpuinfo_desc) / sizeof(cpuinfo_desc[0])) - 1
 }
 
-void cpuinfo_write_file(uint32_t *cpuinfo) {
-    int i,j;
+// v5 descriptors live in CHDK's cpuinfo_v5.c, which isn't part of this port
+const struct cpuinfo_word_desc_s *cpuinfo_get_desc(unsigned layout)
+{
+    switch (layout) {
+        case CPUINFO_LAYOUT_PMSA: return cpuinfo_desc_pmsa;
+        case CPUINFO_LAYOUT_VMSA: return cpuinfo_desc_vmsa;
+    }
+    return NULL;
+}
+
+uint32_t cpuinfo_num_words(unsigned layout)
+{
+    switch (layout) {
+        case CPUINFO_LAYOUT_PMSA:
+            return (cpuinfo_desc_pmsa_size / sizeof(cpuinfo_word_desc_s)) - 1;
+        case CPUINFO_LAYOUT_VMSA:
+            return (cpuinfo_desc_vmsa_size / sizeof(cpuinfo_word_desc_s)) - 1;
+    }
+    return 0;
+}
+
+static const char *layout_names[] = {
+    "unknown", "pmsa", "vmsa", "v5",
+};
+
+const char *cpuinfo_layout_name(unsigned layout)
+{
+    if (layout < sizeof(layout_names) / sizeof(layout_names[0])) {
+        return layout_names[layout];
+    }
+    return layout_names[CPUINFO_LAYOUT_UNKNOWN];
+}
+
+unsigned cpuinfo_layout_by_name(const char *name)
+{
+    unsigned i;
+    for (i = 1; i < sizeof(layout_names) / sizeof(layout_names[0]); i++) {
+        if (strcmp(name, layout_names[i]) == 0) {
+            return i;
+        }
+    }
+    return CPUINFO_LAYOUT_UNKNOWN;
+}
+
+int cpuinfo_word_index(unsigned layout, const char *name)
+{
+    const struct cpuinfo_word_desc_s *desc = cpuinfo_get_desc(layout);
+    int i;
+    for (i = 0; desc && desc[i].name; i++) {
+        if (strcmp(desc[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// one field line, "  name 0xval val [desc]\n", returns its length
+int cpuinfo_format_field(char *buf, const struct cpuinfo_bitfield_desc_s *field, unsigned fieldval) {
+    char *p = buf;
+    p += sprintf(p,"  %-20s 0x%X %d", field->name, fieldval, fieldval);
+    if(field->desc_fn) {
+        STATS_TIMER(t_desc);
+        p += sprintf(p, " [%s]", field->desc_fn(fieldval));
+        STATS_STOP(STAT_DESC_FN, t_desc, 0);
+    }
+    *p++ = '\n';
+    return p - buf;
+}
+
+/*
+Most fields are 1-4 bits wide, so each has at most 16 possible lines.
+Those are formatted once per layout, desc_fn included, and decoding such
+a field is a copy out of the pool.  Wider fields (addresses, set counts)
+still go through cpuinfo_format_field().
+*/
+#define MEMO_MAX_BITS 4
+
+struct field_memo_s {
+    uint32_t off[1 << MEMO_MAX_BITS];   // into pool
+    uint8_t len[1 << MEMO_MAX_BITS];    // 0: field too wide, not memoized
+};
+
+struct layout_memo_s {
+    struct outbuf_s pool;
+    struct field_memo_s *fields;        // all fields of all words, in table order
+    uint32_t *word_off;                 // "%-10s " word name prefix
+    uint8_t *word_len;
+};
+
+static struct layout_memo_s layout_memo[CPUINFO_LAYOUT_V5 + 1];
+static pthread_once_t layout_memo_once[CPUINFO_LAYOUT_V5 + 1] = {
+    PTHREAD_ONCE_INIT, PTHREAD_ONCE_INIT, PTHREAD_ONCE_INIT, PTHREAD_ONCE_INIT,
+};
+
+static void memo_build(struct layout_memo_s *memo, const struct cpuinfo_word_desc_s *desc) {
+    int i, j, k = 0, num_words = 0, num_fields = 0;
+    unsigned v;
+    char buf[256];
+
+    for (i = 0; desc[i].name; i++, num_words++) {
+        for (j = 0; desc[i].fields[j].name; j++) {
+            num_fields++;
+        }
+    }
+    memo->fields = calloc(num_fields, sizeof(struct field_memo_s));
+    memo->word_off = calloc(num_words, sizeof(uint32_t));
+    memo->word_len = calloc(num_words, sizeof(uint8_t));
+    if (!memo->fields || !memo->word_off || !memo->word_len) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    outbuf_init(&memo->pool);
+    for (i = 0; desc[i].name; i++) {
+        memo->word_off[i] = memo->pool.len;
+        outbuf_printf(&memo->pool, "%-10s ", desc[i].name);
+        memo->word_len[i] = memo->pool.len - memo->word_off[i];
+        for (j = 0; desc[i].fields[j].name; j++, k++) {
+            if (desc[i].fields[j].bits > MEMO_MAX_BITS) {
+                continue;
+            }
+            for (v = 0; v < (1u << desc[i].fields[j].bits); v++) {
+                memo->fields[k].off[v] = memo->pool.len;
+                memo->fields[k].len[v] = cpuinfo_format_field(buf, &desc[i].fields[j], v);
+                outbuf_write(&memo->pool, buf, memo->fields[k].len[v]);
+            }
+        }
+    }
+}
+
+static void memo_build_pmsa(void) {
+    memo_build(&layout_memo[CPUINFO_LAYOUT_PMSA], cpuinfo_desc_pmsa);
+}
+
+static void memo_build_vmsa(void) {
+    memo_build(&layout_memo[CPUINFO_LAYOUT_VMSA], cpuinfo_desc_vmsa);
+}
+
+static const struct layout_memo_s *memo_get(unsigned layout) {
+    switch (layout) {
+        case CPUINFO_LAYOUT_PMSA:
+            pthread_once(&layout_memo_once[layout], memo_build_pmsa);
+            break;
+        case CPUINFO_LAYOUT_VMSA:
+            pthread_once(&layout_memo_once[layout], memo_build_vmsa);
+            break;
+        default:
+            return NULL;
+    }
+    return &layout_memo[layout];
+}
+
+static const char hexdigits[] = "0123456789ABCDEF";
+
+#ifndef CPUINFO_GENERATOR
+
+// helpers of the generated decoders, the output of "0x%08X", "%X", "%d", " [%s]"
+static char *put_hex8(char *p, uint32_t v) {
+    int j;
+    for (j = 28; j >= 0; j -= 4) {
+        *p++ = hexdigits[(v >> j) & 15];
+    }
+    return p;
+}
+
+static char *put_hex(char *p, uint32_t v) {
+    int j = 28;
+    while (j > 0 && (v >> j) == 0) {
+        j -= 4;
+    }
+    for (; j >= 0; j -= 4) {
+        *p++ = hexdigits[(v >> j) & 15];
+    }
+    return p;
+}
+
+static char *put_dec(char *p, int32_t v) {
+    char digits[10];
+    uint32_t u = v;
+    int n = 0;
+    if (v < 0) {
+        *p++ = '-';
+        u = -(uint32_t)v;
+    }
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static char *put_desc(char *p, const char *s) {
+    size_t len = strlen(s);
+    *p++ = ' ';
+    *p++ = '[';
+    memcpy(p, s, len);
+    p += len;
+    *p++ = ']';
+    return p;
+}
+
+#include "decoders.inc"
+
+#endif
+
+static int decoder = CPUINFO_DECODER_GENERATED;
+
+void cpuinfo_set_decoder(int which) {
+    decoder = which;
+}
+
+// the straight-line decoders from gen_decoders, same output as the tables
+static int format_generated(struct outbuf_s *ob, const uint32_t *cpuinfo, unsigned layout) {
+#ifndef CPUINFO_GENERATOR
+    char *p;
+    switch (layout) {
+        case CPUINFO_LAYOUT_PMSA:
+            p = decode_pmsa(outbuf_reserve(ob, DECODE_PMSA_MAX), cpuinfo);
+            break;
+        case CPUINFO_LAYOUT_VMSA:
+            p = decode_vmsa(outbuf_reserve(ob, DECODE_VMSA_MAX), cpuinfo);
+            break;
+        default:
+            return -1;
+    }
+    ob->len = p - ob->data;
+    return 0;
+#else
+    (void)ob;
+    (void)cpuinfo;
+    (void)layout;
+    return -1;
+#endif
+}
+
+int cpuinfo_format(struct outbuf_s *ob, const uint32_t *cpuinfo, unsigned layout) {
+    int i,j,k;
     unsigned fieldval, wordval;
     unsigned mask, bits;
-    char buf[100];
     char *p;
-
-    // FIXME - currently we assume the passed in buffer
-    // contains data from a v7 vmsa dump.  We need to 
-    // either determine from the buffer, or, take options
-    // to this function so we can do the right thing.
-    struct cpuinfo_word_desc_s *cpuinfo_desc;
-    cpuinfo_desc = (struct cpuinfo_word_desc_s*) cpuinfo_desc_vmsa;
+    STATS_TIMER(t_decode);
+    size_t start_len = ob->len;
+
+    // the caller knows the layout, either from the dump file header
+    // or from the command line for raw dumps
+    const struct cpuinfo_word_desc_s *cpuinfo_desc;
+    const struct layout_memo_s *memo;
+    if (decoder == CPUINFO_DECODER_GENERATED && format_generated(ob, cpuinfo, layout) == 0) {
+        STATS_STOP(STAT_DECODE, t_decode, ob->len - start_len);
+        return 0;
+    }
+    cpuinfo_desc = cpuinfo_get_desc(layout);
+    memo = memo_get(layout);
+    if (cpuinfo_desc == NULL || memo == NULL) {
+        return -1;
+    }
 /*
 #ifdef THUMB_FW
     struct cpuinfo_word_desc_s *cpuinfo_desc;
@@ -1079,24 +1309,86 @@ void cpuinfo_write_file(uint32_t *cpuinfo) {
     cpuinfo_get_info(cpuinfo);
 #endif
 */
-    for(i = 0; cpuinfo_desc[i].name; i++) {
+    for(i = 0, k = 0; cpuinfo_desc[i].name; i++) {
         wordval = cpuinfo[i];
-        fprintf(stdout, "%-10s 0x%08X\n", cpuinfo_desc[i].name, wordval);
-        for(j=0; cpuinfo_desc[i].fields[j].name; j++) {
-            p = buf;
+        // "%-10s 0x%08X\n"
+        p = outbuf_reserve(ob, memo->word_len[i] + 11);
+        memcpy(p, memo->pool.data + memo->word_off[i], memo->word_len[i]);
+        p += memo->word_len[i];
+        *p++ = '0';
+        *p++ = 'x';
+        for (j = 28; j >= 0; j -= 4) {
+            *p++ = hexdigits[(wordval >> j) & 15];
+        }
+        *p++ = '\n';
+        ob->len = p - ob->data;
+        for(j=0; cpuinfo_desc[i].fields[j].name; j++, k++) {
             bits = cpuinfo_desc[i].fields[j].bits;
             mask = (bits == 32) ? 0xffffffff : ~(0xFFFFFFFF << bits);
             fieldval = wordval & mask;
-            p += sprintf(p,"  %-20s 0x%X %d", cpuinfo_desc[i].fields[j].name, fieldval, fieldval);
-            if(cpuinfo_desc[i].fields[j].desc_fn) {
-                p += sprintf(p, " [%s]", cpuinfo_desc[i].fields[j].desc_fn(fieldval));
+            if (memo->fields[k].len[0]) {
+                outbuf_write(ob, memo->pool.data + memo->fields[k].off[fieldval], memo->fields[k].len[fieldval]);
+            }
+            else {
+                p = outbuf_reserve(ob, 256); // long enough for the longest desc_fn output (MPU region attributes)
+                ob->len += cpuinfo_format_field(p, &cpuinfo_desc[i].fields[j], fieldval);
             }
-            strcat(p, "\n");
-            fprintf(stdout, buf);
             wordval >>= bits;
         }
     }
+    STATS_STOP(STAT_DECODE, t_decode, ob->len - start_len);
+    return 0;
+}
+
+// the same decode as cpuinfo_format(), as a "words" array of the current JSON object
+int cpuinfo_format_json(struct json_s *j, const uint32_t *cpuinfo, unsigned layout) {
+    const struct cpuinfo_word_desc_s *cpuinfo_desc = cpuinfo_get_desc(layout);
+    const struct cpuinfo_bitfield_desc_s *field;
+    unsigned wordval, fieldval, bits;
+    int i, k;
+    STATS_TIMER(t_decode);
+    size_t start_len = j->ob->len;
+
+    if (cpuinfo_desc == NULL) {
+        return -1;
+    }
+    json_array(j, "words");
+    for (i = 0; cpuinfo_desc[i].name; i++) {
+        wordval = cpuinfo[i];
+        json_object(j, NULL);
+        json_string(j, "name", cpuinfo_desc[i].name);
+        json_uint(j, "value", wordval);
+        json_array(j, "fields");
+        for (k = 0; cpuinfo_desc[i].fields[k].name; k++) {
+            field = &cpuinfo_desc[i].fields[k];
+            bits = field->bits;
+            fieldval = wordval & ((bits == 32) ? 0xffffffff : ~(0xFFFFFFFF << bits));
+            json_object(j, NULL);
+            json_string(j, "name", field->name);
+            json_uint(j, "value", fieldval);
+            if (field->desc_fn) {
+                STATS_TIMER(t_desc);
+                json_string(j, "desc", field->desc_fn(fieldval));
+                STATS_STOP(STAT_DESC_FN, t_desc, 0);
+            }
+            json_object_end(j);
+            wordval >>= bits;
+        }
+        json_array_end(j);
+        json_object_end(j);
+    }
+    json_array_end(j);
+    STATS_STOP(STAT_DECODE, t_decode, j->ob->len - start_len);
+    return 0;
+}
+
+void cpuinfo_write_file(const uint32_t *cpuinfo, unsigned layout) {
+    static struct outbuf_s ob;
+    if (cpuinfo_format(&ob, cpuinfo, layout) < 0) {
+        fprintf(stderr, "No descriptor tables for %s layout\n", cpuinfo_layout_name(layout));
+        return;
+    }
+    outbuf_flush(&ob, stdout);
 //    sprintf(buf, lang_str(LANG_CPUINFO_WROTE), "A/CPUINFO.TXT");
 //    gui_mbox_init(LANG_MENU_DEBUG_CPU_INFO,(int)buf,MBOX_FUNC_RESTORE|MBOX_TEXT_CENTER, cpuinfo_finish);
 }
-
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpuinfo.h"
+#include "dumpfile.h"
+#include "zread.h"
+
+#define MAX_HEAD   (1 << 20)    // header, words and image descriptors of a compressed container
+#define LAZY_STEP  (1 << 16)    // image bytes decompressed at least at a time
+
+// image data of a compressed container, decompressed up to filled
+struct dumpfile_lazy_s {
+    void *head;                 // header, words and descriptors
+    struct zread_s *z;
+    uint8_t *data;              // anonymous mapping of all image data
+    size_t size;
+    size_t filled;              // read without the lock, written with it
+    int failed;                 // DUMPFILE_ERR_IO or _CHECKSUM once a fill failed
+    struct dumpfile_sum_s sum;  // of what was read so far, after the header
+    uint32_t checksum;          // from the header
+    pthread_mutex_t lock;
+};
+
+// Fletcher-style sum over little-endian 32-bit words, len must be a multiple of 4
+void dumpfile_sum_init(struct dumpfile_sum_s *sum) {
+    sum->a = 0;
+    sum->b = 0;
+}
+
+void dumpfile_sum_update(struct dumpfile_sum_s *sum, const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t a = sum->a, b = sum->b, w;
+    size_t n;
+    for (n = 0; n + 4 <= len; n += 4) {
+        memcpy(&w, p + n, 4);
+        a += w;
+        b += a;
+    }
+    sum->a = a;
+    sum->b = b;
+}
+
+uint32_t dumpfile_sum_final(const struct dumpfile_sum_s *sum) {
+    return ((sum->b << 16) | (sum->b >> 16)) ^ sum->a;
+}
+
+static int parse_raw(const void *buf, size_t len, unsigned raw_layout, struct dumpfile_s *df) {
+    uint32_t num_words = cpuinfo_num_words(raw_layout);
+    if (num_words == 0) {
+        return DUMPFILE_ERR_LAYOUT;
+    }
+    // the camera writes a buffer sized for the larger of the layouts,
+    // accept that or an exact fit and nothing else
+    if (len != num_words * sizeof(uint32_t) && len != get_num_cpuinfo_words() * sizeof(uint32_t)) {
+        return DUMPFILE_ERR_SIZE;
+    }
+    df->version = 0;
+    df->layout = raw_layout;
+    df->words = buf;
+    df->num_words = num_words;
+    return DUMPFILE_OK;
+}
+
+static void clear(struct dumpfile_s *df) {
+    df->version = 0;
+    df->layout = CPUINFO_LAYOUT_UNKNOWN;
+    df->words = NULL;
+    df->num_words = 0;
+    df->num_images = 0;
+    df->images = NULL;
+    df->image_data = NULL;
+    df->lazy = NULL;
+}
+
+// checks a container header and its descriptors against the container size len;
+// p holds at least the header, words and image descriptors, *data_off is where image data starts
+static int parse_head(const uint8_t *p, size_t avail, uint64_t len, struct dumpfile_s *df, uint64_t *data_off) {
+    const struct dumpfile_hdr_s *hdr = (const struct dumpfile_hdr_s *)p;
+    uint64_t off, data_size;
+    uint32_t n, expect;
+
+    if (hdr->version != DUMPFILE_VERSION) {
+        return DUMPFILE_ERR_VERSION;
+    }
+    if (hdr->hdr_size < sizeof(*hdr) || hdr->hdr_size % 4 || hdr->total_size != len) {
+        return DUMPFILE_ERR_SIZE;
+    }
+    expect = cpuinfo_num_words(hdr->layout);
+    if (expect == 0 && hdr->layout != CPUINFO_LAYOUT_V5) {
+        return DUMPFILE_ERR_LAYOUT;
+    }
+    if (expect != 0 && hdr->num_words != expect) {
+        return DUMPFILE_ERR_WORDS;
+    }
+
+    off = hdr->hdr_size + (uint64_t)hdr->num_words * sizeof(uint32_t);
+    if (off > len || (len - off) / sizeof(struct dumpfile_image_s) < hdr->num_images) {
+        return DUMPFILE_ERR_SIZE;
+    }
+    df->images = (const struct dumpfile_image_s *)(p + off);
+    off += (uint64_t)hdr->num_images * sizeof(struct dumpfile_image_s);
+    if (off > avail) {
+        return DUMPFILE_ERR_SIZE;
+    }
+    data_size = 0;
+    for (n = 0; n < hdr->num_images; n++) {
+        if (df->images[n].size % 4 || df->images[n].size > len - off - data_size) {
+            return DUMPFILE_ERR_IMAGES;
+        }
+        data_size += df->images[n].size;
+    }
+    if (off + data_size != len) {
+        return DUMPFILE_ERR_SIZE;
+    }
+    df->version = hdr->version;
+    df->layout = hdr->layout;
+    df->words = (const uint32_t *)(p + hdr->hdr_size);
+    df->num_words = hdr->num_words;
+    df->num_images = hdr->num_images;
+    *data_off = off;
+    return DUMPFILE_OK;
+}
+
+int dumpfile_parse(const void *buf, size_t len, unsigned raw_layout, struct dumpfile_s *df) {
+    const struct dumpfile_hdr_s *hdr = buf;
+    const uint8_t *p = buf;
+    struct dumpfile_sum_s sum;
+    uint64_t off;
+    int ret;
+
+    clear(df);
+    if (len < sizeof(*hdr) || hdr->magic != DUMPFILE_MAGIC) {
+        return parse_raw(buf, len, raw_layout, df);
+    }
+    ret = parse_head(p, len, len, df, &off);
+    if (ret != DUMPFILE_OK) {
+        clear(df);
+        return ret;
+    }
+    dumpfile_sum_init(&sum);
+    dumpfile_sum_update(&sum, p + hdr->hdr_size, len - hdr->hdr_size);
+    if (dumpfile_sum_final(&sum) != hdr->checksum) {
+        clear(df);
+        return DUMPFILE_ERR_CHECKSUM;
+    }
+    df->image_data = p + off;
+    return DUMPFILE_OK;
+}
+
+int dumpfile_is_compressed(const void *buf, size_t len) {
+    return zread_detect(buf, len) != ZREAD_NONE;
+}
+
+static void lazy_free(struct dumpfile_lazy_s *lz) {
+    zread_close(lz->z);
+    if (lz->data) {
+        munmap(lz->data, lz->size);
+    }
+    pthread_mutex_destroy(&lz->lock);
+    free(lz->head);
+    free(lz);
+}
+
+// makes image data [0, end) readable; walk tasks of the same dump can get here at once.
+// The sum is checked when the last byte comes in, and that byte is not made
+// readable on a mismatch; what was read before it already has been
+static int lazy_fill(struct dumpfile_lazy_s *lz, size_t end) {
+    if (__atomic_load_n(&lz->filled, __ATOMIC_ACQUIRE) >= end) {
+        return 0;
+    }
+    pthread_mutex_lock(&lz->lock);
+    while (lz->filled < end && !lz->failed) {
+        size_t want = lz->size - lz->filled;
+        if (want > LAZY_STEP && want > end - lz->filled) {
+            want = end - lz->filled > LAZY_STEP ? end - lz->filled : LAZY_STEP;
+            want = (want + 3) & ~(size_t)3; // the sum goes by words, size is a multiple of 4
+        }
+        if (zread_read(lz->z, lz->data + lz->filled, want) != (ssize_t)want) {
+            lz->failed = DUMPFILE_ERR_IO;
+            break;
+        }
+        dumpfile_sum_update(&lz->sum, lz->data + lz->filled, want);
+        if (lz->filled + want == lz->size && dumpfile_sum_final(&lz->sum) != lz->checksum) {
+            lz->failed = DUMPFILE_ERR_CHECKSUM;
+            break;
+        }
+        __atomic_store_n(&lz->filled, lz->filled + want, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&lz->lock);
+    return lz->filled >= end ? 0 : -1;
+}
+
+// the registers of a compressed file, the images are left in the stream
+static int open_compressed(int fd, int codec, unsigned raw_layout, struct dumpfile_s *df) {
+    struct dumpfile_lazy_s *lz;
+    struct dumpfile_hdr_s hdr;
+    uint64_t head_size, off, data_size;
+    ssize_t n;
+    int ret;
+
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return DUMPFILE_ERR_IO;
+    }
+    lz = calloc(1, sizeof(*lz));
+    if (lz == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    pthread_mutex_init(&lz->lock, NULL);
+    lz->z = zread_open(fd, codec);
+    if (lz->z == NULL) {
+        close(fd);
+        lazy_free(lz);
+        return DUMPFILE_ERR_CODEC;
+    }
+    n = zread_read(lz->z, &hdr, sizeof(hdr));
+    if (n < 0) {
+        lazy_free(lz);
+        return DUMPFILE_ERR_IO;
+    }
+    if ((size_t)n < sizeof(hdr) || hdr.magic != DUMPFILE_MAGIC) {
+        // raw dump: the words, and at most one more to tell a longer file
+        size_t len = get_num_cpuinfo_words() * sizeof(uint32_t) + 4;
+        lz->head = malloc(len);
+        if (lz->head == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        memcpy(lz->head, &hdr, n);
+        if ((size_t)n == sizeof(hdr)) {
+            ssize_t more = zread_read(lz->z, (char *)lz->head + n, len - n);
+            if (more < 0) {
+                lazy_free(lz);
+                return DUMPFILE_ERR_IO;
+            }
+            n += more;
+        }
+        ret = parse_raw(lz->head, n, raw_layout, df);
+    }
+    else {
+        head_size = hdr.hdr_size + (uint64_t)hdr.num_words * sizeof(uint32_t) +
+                    (uint64_t)hdr.num_images * sizeof(struct dumpfile_image_s);
+        if (hdr.hdr_size < sizeof(hdr) || head_size > MAX_HEAD || head_size > hdr.total_size) {
+            lazy_free(lz);
+            return DUMPFILE_ERR_SIZE;
+        }
+        lz->head = malloc(head_size);
+        if (lz->head == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        memcpy(lz->head, &hdr, sizeof(hdr));
+        n = zread_read(lz->z, (char *)lz->head + sizeof(hdr), head_size - sizeof(hdr));
+        if (n != (ssize_t)(head_size - sizeof(hdr))) {
+            lazy_free(lz);
+            return n < 0 ? DUMPFILE_ERR_IO : DUMPFILE_ERR_SIZE;
+        }
+        ret = parse_head(lz->head, head_size, hdr.total_size, df, &off);
+        data_size = hdr.total_size - off;
+        // the sum covers everything after the header; the images add to it as they are read
+        dumpfile_sum_init(&lz->sum);
+        dumpfile_sum_update(&lz->sum, (char *)lz->head + hdr.hdr_size, head_size - hdr.hdr_size);
+        lz->checksum = hdr.checksum;
+        if (ret == DUMPFILE_OK && data_size == 0 && dumpfile_sum_final(&lz->sum) != lz->checksum) {
+            ret = DUMPFILE_ERR_CHECKSUM;
+        }
+        if (ret == DUMPFILE_OK && (size_t)data_size != data_size) {
+            ret = DUMPFILE_ERR_SIZE;
+        }
+        if (ret == DUMPFILE_OK && data_size > 0) {
+            lz->size = data_size;
+            lz->data = mmap(NULL, lz->size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (lz->data == MAP_FAILED) {
+                lz->data = NULL;
+                ret = DUMPFILE_ERR_IO;
+            }
+            df->image_data = lz->data;
+        }
+    }
+    if (ret != DUMPFILE_OK) {
+        clear(df);
+        lazy_free(lz);
+        return ret;
+    }
+    df->lazy = lz;
+    return DUMPFILE_OK;
+}
+
+// maps the whole file once and validates it in place
+int dumpfile_open(const char *path, unsigned raw_layout, struct dumpfile_s *df) {
+    struct stat st;
+    void *map;
+    int fd, ret, codec;
+
+    df->map = NULL;
+    df->map_size = 0;
+    clear(df);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return DUMPFILE_ERR_IO;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return DUMPFILE_ERR_IO;
+    }
+    if (st.st_size == 0 || (off_t)(size_t)st.st_size != st.st_size) {
+        close(fd);
+        return DUMPFILE_ERR_SIZE;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return DUMPFILE_ERR_IO;
+    }
+    codec = zread_detect(map, st.st_size);
+    if (codec != ZREAD_NONE) {
+        munmap(map, st.st_size);
+        return open_compressed(fd, codec, raw_layout, df);
+    }
+    close(fd);
+    ret = dumpfile_parse(map, st.st_size, raw_layout, df);
+    if (ret != DUMPFILE_OK) {
+        munmap(map, st.st_size);
+        return ret;
+    }
+    df->map = map;
+    df->map_size = st.st_size;
+    return DUMPFILE_OK;
+}
+
+void dumpfile_close(struct dumpfile_s *df) {
+    if (df->map) {
+        munmap(df->map, df->map_size);
+    }
+    if (df->lazy) {
+        lazy_free(df->lazy);
+    }
+    df->lazy = NULL;
+    df->map = NULL;
+    df->map_size = 0;
+    df->words = NULL;
+}
+
+// DUMPFILE_OK, or why the images of a compressed file could not all be read
+int dumpfile_error(const struct dumpfile_s *df) {
+    int err = DUMPFILE_OK;
+    if (df->lazy) {
+        pthread_mutex_lock(&df->lazy->lock);
+        err = df->lazy->failed;
+        pthread_mutex_unlock(&df->lazy->lock);
+    }
+    return err;
+}
+
+const char *dumpfile_strerror(int err) {
+    switch (err) {
+        case DUMPFILE_OK: return "ok";
+        case DUMPFILE_ERR_IO: return "cannot read file";
+        case DUMPFILE_ERR_SIZE: return "unexpected size, truncated or not a dump";
+        case DUMPFILE_ERR_VERSION: return "unsupported container version";
+        case DUMPFILE_ERR_LAYOUT: return "unknown register layout";
+        case DUMPFILE_ERR_WORDS: return "word count does not match layout";
+        case DUMPFILE_ERR_IMAGES: return "bad page-table image descriptor";
+        case DUMPFILE_ERR_CHECKSUM: return "checksum mismatch";
+        case DUMPFILE_ERR_CODEC: return "compressed, and this build cannot decompress it";
+    }
+    return "unknown error";
+}
+
+// returns a pointer to len bytes at physical address pa, if one image holds all of them
+const void *dumpfile_phys(const struct dumpfile_s *df, uint64_t pa, uint64_t len) {
+    const uint8_t *data = df->image_data;
+    uint32_t n;
+    for (n = 0; n < df->num_images; n++) {
+        const struct dumpfile_image_s *img = &df->images[n];
+        if (pa >= img->phys_addr && len <= img->size && pa - img->phys_addr <= img->size - len) {
+            data += pa - img->phys_addr;
+            if (df->lazy && lazy_fill(df->lazy, data + len - df->image_data) < 0) {
+                return NULL;
+            }
+            return data;
+        }
+        data += img->size;
+    }
+    return NULL;
+}
+
+// all data of image n, NULL if it cannot be read
+const void *dumpfile_image(const struct dumpfile_s *df, uint32_t n) {
+    const uint8_t *data = df->image_data;
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        data += df->images[i].size;
+    }
+    if (df->lazy && lazy_fill(df->lazy, data + df->images[n].size - df->image_data) < 0) {
+        return NULL;
+    }
+    return data;
+}
+
+int dumpfile_write(FILE *f, unsigned layout, const uint32_t *words, uint32_t num_words,
+                   const struct dumpfile_image_s *images, const void *const *image_data,
+                   uint32_t num_images) {
+    struct dumpfile_hdr_s hdr;
+    struct dumpfile_sum_s sum;
+    uint32_t n;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = DUMPFILE_MAGIC;
+    hdr.version = DUMPFILE_VERSION;
+    hdr.layout = layout;
+    hdr.hdr_size = sizeof(hdr);
+    hdr.num_words = num_words;
+    hdr.num_images = num_images;
+    hdr.total_size = sizeof(hdr) + (uint64_t)num_words * sizeof(uint32_t)
+                     + (uint64_t)num_images * sizeof(struct dumpfile_image_s);
+
+    dumpfile_sum_init(&sum);
+    dumpfile_sum_update(&sum, words, num_words * sizeof(uint32_t));
+    dumpfile_sum_update(&sum, images, num_images * sizeof(struct dumpfile_image_s));
+    for (n = 0; n < num_images; n++) {
+        if (images[n].size % 4) {
+            return DUMPFILE_ERR_IMAGES;
+        }
+        dumpfile_sum_update(&sum, image_data[n], images[n].size);
+        hdr.total_size += images[n].size;
+    }
+    hdr.checksum = dumpfile_sum_final(&sum);
+
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+        || fwrite(words, sizeof(uint32_t), num_words, f) != num_words
+        || fwrite(images, sizeof(struct dumpfile_image_s), num_images, f) != num_images) {
+        return DUMPFILE_ERR_IO;
+    }
+    for (n = 0; n < num_images; n++) {
+        if (images[n].size && fwrite(image_data[n], images[n].size, 1, f) != 1) {
+            return DUMPFILE_ERR_IO;
+        }
+    }
+    return DUMPFILE_OK;
+}
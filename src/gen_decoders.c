@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuinfo.h"
+
+/*
+Build step: writes decoders.inc, one straight-line function per word of
+each register layout, for cpuinfo.c to include.  It is linked against
+the same descriptor tables it describes, so the generated code cannot
+drift from them.  Fields of up to GEN_MEMO_BITS bits become a constant
+table of their formatted lines, desc_fn output included; wider fields
+keep their desc_fn, called through the table, but get the shift, mask
+and name padding as constants.
+*/
+
+#define GEN_MEMO_BITS 4
+#define DESC_LEN      255       // desc_fn output fits the 256 byte line buffer
+
+static void put_literal(const char *s, size_t len) {
+    size_t i;
+    putchar('"');
+    for (i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        }
+        else if (c == '\n') {
+            printf("\\n");
+        }
+        else if (c < 0x20 || c >= 0x7f || c == '?') {
+            printf("\\%03o", c);    // '?' too, no trigraphs
+        }
+        else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+// writes the function for word i, returns the most bytes it can output
+static size_t gen_word(const char *lname, int i, const struct cpuinfo_word_desc_s *word) {
+    char buf[512];
+    size_t max;
+    unsigned shift = 0;
+    int j, n;
+
+    printf("// %s\n", word->name);
+    printf("static char *decode_%s_%d(char *p, uint32_t w) {\n", lname, i);
+    n = sprintf(buf, "%-10s 0x", word->name);
+    printf("    memcpy(p, ");
+    put_literal(buf, n);
+    printf(", %d);\n", n);
+    printf("    p = put_hex8(p + %d, w);\n", n);
+    printf("    *p++ = '\\n';\n");
+    max = n + 9;
+
+    for (j = 0; word->fields[j].name; j++) {
+        const struct cpuinfo_bitfield_desc_s *field = &word->fields[j];
+        unsigned bits = field->bits;
+        char val[48];
+
+        if (bits == 32) {
+            sprintf(val, "w");
+        }
+        else if (shift == 0) {
+            sprintf(val, "w & 0x%Xu", (1u << bits) - 1);
+        }
+        else if (shift + bits == 32) {
+            sprintf(val, "w >> %u", shift);
+        }
+        else {
+            sprintf(val, "(w >> %u) & 0x%Xu", shift, (1u << bits) - 1);
+        }
+
+        if (bits <= GEN_MEMO_BITS) {
+            unsigned v, width = 0;
+            int lens[1 << GEN_MEMO_BITS];
+            for (v = 0; v < (1u << bits); v++) {
+                lens[v] = cpuinfo_format_field(buf, field, v);
+                if ((unsigned)lens[v] > width) {
+                    width = lens[v];
+                }
+            }
+            width = (width + 7) & ~7u;  // rows are copied whole
+            printf("    {   // %s\n", field->name);
+            printf("        static const char line[%u][%u] = {\n", 1u << bits, width);
+            for (v = 0; v < (1u << bits); v++) {
+                cpuinfo_format_field(buf, field, v);
+                printf("            ");
+                put_literal(buf, lens[v]);
+                printf(",\n");
+            }
+            printf("        };\n");
+            printf("        static const uint8_t len[%u] = {", 1u << bits);
+            for (v = 0; v < (1u << bits); v++) {
+                printf("%s%d", v ? ", " : " ", lens[v]);
+            }
+            printf(" };\n");
+            printf("        unsigned v = %s;\n", val);
+            printf("        memcpy(p, line[v], %u);\n", width);
+            printf("        p += len[v];\n");
+            printf("    }\n");
+            max += width;
+        }
+        else {
+            n = sprintf(buf, "  %-20s 0x", field->name);
+            printf("    {   // %s\n", field->name);
+            printf("        unsigned v = %s;\n", val);
+            printf("        memcpy(p, ");
+            put_literal(buf, n);
+            printf(", %d);\n", n);
+            printf("        p = put_hex(p + %d, v);\n", n);
+            printf("        *p++ = ' ';\n");
+            printf("        p = put_dec(p, v);\n");
+            if (field->desc_fn) {
+                // timed like the table decoder, so --stats has the same desc_fn row
+                printf("        STATS_TIMER(t_desc);\n");
+                printf("        p = put_desc(p, %s[%d].fields[%d].desc_fn(v));\n",
+                       strcmp(lname, "pmsa") == 0 ? "cpuinfo_desc_pmsa" : "cpuinfo_desc_vmsa", i, j);
+                printf("        STATS_STOP(STAT_DESC_FN, t_desc, 0);\n");
+            }
+            printf("        *p++ = '\\n';\n");
+            printf("    }\n");
+            // hex digits, space, sign and decimal digits, " [desc]", newline
+            max += n + 8 + 1 + 11 + (field->desc_fn ? 3 + DESC_LEN : 0) + 1;
+        }
+        shift += bits;
+    }
+    printf("    return p;\n");
+    printf("}\n\n");
+    return max;
+}
+
+static void gen_layout(unsigned layout) {
+    const struct cpuinfo_word_desc_s *desc = cpuinfo_get_desc(layout);
+    const char *lname = cpuinfo_layout_name(layout);
+    size_t max = 0;
+    int i, num;
+
+    for (i = 0; desc[i].name; i++) {
+        max += gen_word(lname, i, &desc[i]);
+    }
+    num = i;
+    printf("#define DECODE_%s_MAX %zu\n\n", layout == CPUINFO_LAYOUT_PMSA ? "PMSA" : "VMSA", max);
+    printf("static char *decode_%s(char *p, const uint32_t *w) {\n", lname);
+    for (i = 0; i < num; i++) {
+        printf("    p = decode_%s_%d(p, w[%d]);\n", lname, i, i);
+    }
+    printf("    return p;\n");
+    printf("}\n\n");
+}
+
+int main(void) {
+    printf("// generated by gen_decoders from the descriptor tables in cpuinfo.c, do not edit\n\n");
+    gen_layout(CPUINFO_LAYOUT_PMSA);
+    gen_layout(CPUINFO_LAYOUT_VMSA);
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuinfo.h"
+#include "dumpfile.h"
+#include "ingest.h"
+#include "outbuf.h"
+#include "query.h"
+#include "json.h"
+#include "batch.h"
+#include "group.h"
+#include "stats.h"
+
+/*
+Dumps of a fleet mostly differ in a few volatile words: debug status,
+which core wrote the dump.  With those words masked out, dumps fall into
+a handful of classes, one per hardware/firmware configuration.  One
+streaming pass over the list hashes each dump's masked words into an
+open addressing table of classes; afterwards only the first dump of each
+class is decoded, headed by the class size.
+*/
+
+// masked when no --mask is given
+static const char *default_mask[] = { "DBGDSCR", "Multiprocessor ID" };
+
+struct group_class_s {
+    uint64_t hash;
+    unsigned layout;
+    unsigned num_words;
+    uint32_t words[GROUP_MAX_WORDS];    // of the first dump, unmasked
+    size_t count;
+    const char *path;
+};
+
+struct group_s {
+    const struct batch_opts_s *opts;
+    uint64_t mask[CPUINFO_LAYOUT_V5 + 1];   // bit n: word n is ignored
+    struct group_class_s *classes;
+    unsigned num, cap;
+    unsigned *slots;                        // class index + 1, 0 if empty
+    unsigned slot_mask;
+    size_t num_dumps;
+    int failed;
+};
+
+#define FNV64_BASIS 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+
+static uint64_t masked_hash(unsigned layout, const uint32_t *words, unsigned num, uint64_t mask) {
+    uint64_t h = (FNV64_BASIS ^ layout) * FNV64_PRIME;
+    unsigned n;
+    for (n = 0; n < num; n++) {
+        uint32_t w = (mask >> n) & 1 ? 0 : words[n];
+        h = (h ^ w) * FNV64_PRIME;
+    }
+    return h;
+}
+
+static int same_class(const struct group_class_s *c, unsigned layout, const uint32_t *words,
+                      unsigned num, uint64_t mask) {
+    unsigned n;
+    if (c->layout != layout || c->num_words != num) {
+        return 0;
+    }
+    for (n = 0; n < num; n++) {
+        if (!((mask >> n) & 1) && c->words[n] != words[n]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void grow_slots(struct group_s *g) {
+    unsigned size = g->slots ? 2 * (g->slot_mask + 1) : 256;
+    unsigned i, n;
+    free(g->slots);
+    g->slots = calloc(size, sizeof(unsigned));
+    if (g->slots == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    g->slot_mask = size - 1;
+    for (i = 0; i < g->num; i++) {
+        for (n = g->classes[i].hash & g->slot_mask; g->slots[n]; n = (n + 1) & g->slot_mask) {
+        }
+        g->slots[n] = i + 1;
+    }
+}
+
+static void add_dump(struct group_s *g, const char *path, const struct dumpfile_s *df) {
+    unsigned num = cpuinfo_num_words(df->layout);
+    uint64_t mask = g->mask[df->layout];
+    uint64_t h;
+    unsigned n;
+    struct group_class_s *c;
+
+    if (num > df->num_words) {
+        num = df->num_words;
+    }
+    h = masked_hash(df->layout, df->words, num, mask);
+    for (n = h & g->slot_mask; g->slots[n]; n = (n + 1) & g->slot_mask) {
+        c = &g->classes[g->slots[n] - 1];
+        if (c->hash == h && same_class(c, df->layout, df->words, num, mask)) {
+            c->count++;
+            return;
+        }
+    }
+    if (g->num == g->cap) {
+        unsigned cap = g->cap ? 2 * g->cap : 64;
+        c = realloc(g->classes, cap * sizeof(*c));
+        if (c == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        g->classes = c;
+        g->cap = cap;
+    }
+    c = &g->classes[g->num];
+    c->hash = h;
+    c->layout = df->layout;
+    c->num_words = num;
+    memcpy(c->words, df->words, num * 4);
+    c->count = 1;
+    c->path = path;
+    g->slots[n] = ++g->num;
+    if (2 * g->num > g->slot_mask) {
+        grow_slots(g);
+    }
+}
+
+static void ingest_dump(void *ctx, size_t index, const char *path,
+                        const void *buf, size_t len, int status) {
+    struct group_s *g = ctx;
+    struct dumpfile_s df;
+    int err;
+    (void)index;
+
+    df.map = NULL;
+    df.lazy = NULL;
+    if (status < 0) {
+        err = DUMPFILE_ERR_IO;
+    }
+    else if (status == INGEST_PARTIAL || dumpfile_is_compressed(buf, len)) {
+        err = dumpfile_open(path, g->opts->raw_layout, &df);
+    }
+    else {
+        err = dumpfile_parse(buf, len, g->opts->raw_layout, &df);
+    }
+    if (err == DUMPFILE_OK && cpuinfo_num_words(df.layout) > GROUP_MAX_WORDS) {
+        err = DUMPFILE_ERR_WORDS;
+    }
+    if (err != DUMPFILE_OK) {
+        fprintf(stderr, "%s: %s\n", path, dumpfile_strerror(err));
+        g->failed = 1;
+        return;
+    }
+    g->num_dumps++;
+    add_dump(g, path, &df);
+    dumpfile_close(&df);
+}
+
+static void write_class(const struct group_s *g, unsigned i, struct outbuf_s *ob) {
+    const struct group_class_s *c = &g->classes[i];
+    const struct query_s *query = g->opts->query;
+    struct json_s j;
+
+    if (g->opts->json) {
+        json_begin(&j, ob);
+        json_uint(&j, "class", i + 1);
+        json_uint(&j, "count", c->count);
+        json_string(&j, "path", c->path);
+        json_string(&j, "layout", cpuinfo_layout_name(c->layout));
+        if (query) {
+            query_format_json(query, &j, c->words, c->layout);
+        }
+        else {
+            cpuinfo_format_json(&j, c->words, c->layout);
+        }
+        json_end(&j);
+        return;
+    }
+    outbuf_printf(ob, "# class %u: %zu dumps, first %s\n", i + 1, c->count, c->path);
+    if (query) {
+        query_format(query, ob, c->words, c->layout);
+    }
+    else {
+        cpuinfo_format(ob, c->words, c->layout);
+    }
+}
+
+// mask holds word names; a name only has to exist in one of the layouts
+int group_run(const struct batch_opts_s *opts, const struct ingest_list_s *list,
+              const char *const *mask, unsigned num_mask) {
+    struct group_s g;
+    struct outbuf_s ob;
+    unsigned layout, n;
+
+    memset(&g, 0, sizeof(g));
+    g.opts = opts;
+    if (num_mask == 0) {
+        mask = default_mask;
+        num_mask = sizeof(default_mask) / sizeof(default_mask[0]);
+    }
+    for (n = 0; n < num_mask; n++) {
+        int found = 0;
+        for (layout = 0; layout <= CPUINFO_LAYOUT_V5; layout++) {
+            int i = cpuinfo_word_index(layout, mask[n]);
+            if (i >= 0 && i < GROUP_MAX_WORDS) {
+                g.mask[layout] |= 1ULL << i;
+                found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown word %s\n", mask[n]);
+            return -1;
+        }
+    }
+    grow_slots(&g);
+
+    ingest_files(list, opts->use_uring, ingest_dump, &g);
+
+    outbuf_init(&ob);
+    STATS_TIMER(t);
+    if (!opts->json) {
+        outbuf_printf(&ob, "# %zu dumps in %u classes\n", g.num_dumps, g.num);
+    }
+    for (n = 0; n < g.num; n++) {
+        write_class(&g, n, &ob);
+    }
+    STATS_STOP(STAT_WRITE, t, ob.len);
+    outbuf_flush(&ob, stdout);
+    fflush(stdout);
+    outbuf_free(&ob);
+    free(g.classes);
+    free(g.slots);
+    return g.failed ? -1 : 0;
+}
@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+#include "ingest.h"
+#include "stats.h"
+
+static int list_push(struct ingest_list_s *list, char *path) {
+    if (list->num == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        char **p = realloc(list->paths, cap * sizeof(*p));
+        if (p == NULL) {
+            free(path);
+            return -1;
+        }
+        list->paths = p;
+        list->cap = cap;
+    }
+    list->paths[list->num++] = path;
+    return 0;
+}
+
+static int cmp_path(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// adds a file, or every regular file in a directory, sorted by name
+int ingest_list_add(struct ingest_list_s *list, const char *path) {
+    struct stat st;
+    struct dirent *de;
+    DIR *d;
+    size_t first;
+
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        char *p = strdup(path);
+        return p ? list_push(list, p) : -1;
+    }
+    d = opendir(path);
+    if (d == NULL) {
+        return -1;
+    }
+    first = list->num;
+    while ((de = readdir(d)) != NULL) {
+        char *p;
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        if (asprintf(&p, "%s/%s", path, de->d_name) < 0) {
+            closedir(d);
+            return -1;
+        }
+        if (de->d_type != DT_REG && (de->d_type != DT_UNKNOWN || stat(p, &st) < 0 || !S_ISREG(st.st_mode))) {
+            free(p);
+            continue;
+        }
+        if (list_push(list, p) < 0) {
+            closedir(d);
+            return -1;
+        }
+    }
+    closedir(d);
+    qsort(list->paths + first, list->num - first, sizeof(char *), cmp_path);
+    return 0;
+}
+
+void ingest_list_free(struct ingest_list_s *list) {
+    size_t n;
+    for (n = 0; n < list->num; n++) {
+        free(list->paths[n]);
+    }
+    free(list->paths);
+    list->paths = NULL;
+    list->num = list->cap = 0;
+}
+
+// blocking fallback, one open/pread/close per file
+static int ingest_pread(const struct ingest_list_s *list, size_t first, ingest_fn fn, void *ctx) {
+    static char buf[INGEST_BUF_SIZE];
+    size_t n;
+    for (n = first; n < list->num; n++) {
+        ssize_t len = -1;
+        STATS_TIMER(t);
+        int status, fd = open(list->paths[n], O_RDONLY);
+        if (fd >= 0) {
+            len = pread(fd, buf, sizeof(buf), 0);
+            status = len < 0 ? -errno : len == sizeof(buf) ? INGEST_PARTIAL : INGEST_OK;
+            close(fd);
+        }
+        else {
+            status = -errno;
+        }
+        STATS_STOP(STAT_READ, t, len < 0 ? 0 : len);
+        fn(ctx, n, list->paths[n], buf, len < 0 ? 0 : len, status);
+    }
+    return 0;
+}
+
+#ifdef __NR_io_uring_setup
+
+struct uring_s {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned to_submit;
+};
+
+// one slot per file in flight, file n always uses slot n % INGEST_DEPTH
+enum { SLOT_FREE, SLOT_OPEN, SLOT_READ, SLOT_READY, SLOT_CLOSE };
+enum { OP_OPEN, OP_READ, OP_CLOSE };
+
+struct slot_s {
+    int state;
+    int fd;
+    int res;
+};
+
+static int uring_setup(struct uring_s *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        return -1;
+    }
+    // OPENAT/READ/CLOSE arrived in 5.6, FAST_POLL in 5.7: use it as the version check
+    if (!(p.features & IORING_FEAT_FAST_POLL)) {
+        close(r->fd);
+        return -1;
+    }
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_map = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+        if (r->sq_map != MAP_FAILED) munmap(r->sq_map, r->sq_len);
+        if (r->cq_map != MAP_FAILED) munmap(r->cq_map, r->cq_len);
+        if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+        close(r->fd);
+        return -1;
+    }
+    r->sq_tail = (unsigned *)((char *)r->sq_map + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_map + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_map + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_map + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_map + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_map + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_map + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_teardown(struct uring_s *r) {
+    munmap(r->sqes, r->sqes_len);
+    munmap(r->cq_map, r->cq_len);
+    munmap(r->sq_map, r->sq_len);
+    close(r->fd);
+}
+
+// queues an sqe; we are the only producer, so the tail needs no atomic read
+static struct io_uring_sqe *uring_sqe(struct uring_s *r, unsigned slot, unsigned op) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = ((uint64_t)slot << 2) | op;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    return sqe;
+}
+
+// after the ring failed: drops the sqes never submitted and waits for the
+// ones in flight, closing every file that is or becomes open.  Returns -1
+// if the ring can't even be waited on, and reads may still land in the buffers
+static int uring_abort(struct uring_s *r, struct slot_s *slots, unsigned inflight) {
+    unsigned tail = *r->sq_tail;
+    unsigned n;
+
+    // the kernel only takes sqes we pass it, so these never run
+    for (; r->to_submit; r->to_submit--) {
+        struct io_uring_sqe *sqe = &r->sqes[(tail - r->to_submit) & *r->sq_mask];
+        struct slot_s *slot = &slots[sqe->user_data >> 2];
+        switch (sqe->user_data & 3) {
+            case OP_OPEN:
+                slot->state = SLOT_FREE;
+                break;
+            case OP_READ:
+                slot->state = SLOT_READY;
+                break;
+            case OP_CLOSE:
+                close(sqe->fd);
+                slot->state = SLOT_FREE;
+                break;
+        }
+    }
+    while (inflight) {
+        int ret = syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        unsigned cq_head = *r->cq_head;
+        unsigned cq_tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; cq_head != cq_tail; cq_head++, inflight--) {
+            struct io_uring_cqe *cqe = &r->cqes[cq_head & *r->cq_mask];
+            struct slot_s *slot = &slots[cqe->user_data >> 2];
+            switch (cqe->user_data & 3) {
+                case OP_OPEN:
+                    if (cqe->res >= 0) {
+                        close(cqe->res);
+                    }
+                    slot->state = SLOT_FREE;
+                    break;
+                case OP_READ:
+                    slot->state = SLOT_READY;
+                    break;
+                case OP_CLOSE:
+                    slot->state = SLOT_FREE;
+                    break;
+            }
+        }
+        __atomic_store_n(r->cq_head, cq_head, __ATOMIC_RELEASE);
+    }
+    // read but not handed over
+    for (n = 0; n < INGEST_DEPTH; n++) {
+        if (slots[n].state == SLOT_READY && slots[n].fd >= 0) {
+            close(slots[n].fd);
+        }
+    }
+    return 0;
+}
+
+// returns the number of files handed over, which is less than
+// list->num only if the ring failed part way through
+static size_t ingest_uring(struct uring_s *r, const struct ingest_list_s *list, ingest_fn fn, void *ctx) {
+    struct slot_s slots[INGEST_DEPTH];
+    char *bufs;
+    size_t head = 0, next = 0;
+    unsigned n, inflight = 0;
+
+    bufs = malloc((size_t)INGEST_DEPTH * INGEST_BUF_SIZE);
+    if (bufs == NULL) {
+        return 0;
+    }
+    for (n = 0; n < INGEST_DEPTH; n++) {
+        slots[n].state = SLOT_FREE;
+    }
+
+    while (head < list->num) {
+        // keep the window full
+        while (next < list->num && next < head + INGEST_DEPTH && slots[next % INGEST_DEPTH].state == SLOT_FREE) {
+            unsigned s = next % INGEST_DEPTH;
+            struct io_uring_sqe *sqe = uring_sqe(r, s, OP_OPEN);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)list->paths[next];
+            sqe->open_flags = O_RDONLY;
+            slots[s].state = SLOT_OPEN;
+            next++;
+        }
+
+        STATS_TIMER(t);
+        int ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        STATS_ADD_TICKS(STAT_READ, t);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        r->to_submit -= ret;
+        inflight += ret;
+
+        unsigned cq_head = *r->cq_head;
+        unsigned cq_tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; cq_head != cq_tail; cq_head++, inflight--) {
+            struct io_uring_cqe *cqe = &r->cqes[cq_head & *r->cq_mask];
+            unsigned s = cqe->user_data >> 2;
+            struct slot_s *slot = &slots[s];
+            switch (cqe->user_data & 3) {
+                case OP_OPEN:
+                    if (cqe->res < 0) {
+                        slot->res = cqe->res;
+                        slot->fd = -1;
+                        slot->state = SLOT_READY;
+                    }
+                    else {
+                        struct io_uring_sqe *sqe = uring_sqe(r, s, OP_READ);
+                        sqe->opcode = IORING_OP_READ;
+                        sqe->fd = cqe->res;
+                        sqe->addr = (uintptr_t)(bufs + (size_t)s * INGEST_BUF_SIZE);
+                        sqe->len = INGEST_BUF_SIZE;
+                        slot->fd = cqe->res;
+                        slot->state = SLOT_READ;
+                    }
+                    break;
+                case OP_READ:
+                    slot->res = cqe->res;
+                    slot->state = SLOT_READY;
+                    break;
+                case OP_CLOSE:
+                    slot->state = SLOT_FREE;
+                    break;
+            }
+        }
+        __atomic_store_n(r->cq_head, cq_head, __ATOMIC_RELEASE);
+
+        // hand over completed files in list order, then close them through the ring
+        while (head < next && slots[head % INGEST_DEPTH].state == SLOT_READY) {
+            unsigned s = head % INGEST_DEPTH;
+            struct slot_s *slot = &slots[s];
+            int res = slot->res;
+            STATS_ADD(STAT_READ, 1, res < 0 ? 0 : res);
+            fn(ctx, head, list->paths[head], bufs + (size_t)s * INGEST_BUF_SIZE, res < 0 ? 0 : res,
+               res < 0 ? res : res == INGEST_BUF_SIZE ? INGEST_PARTIAL : INGEST_OK);
+            if (slot->fd >= 0) {
+                struct io_uring_sqe *sqe = uring_sqe(r, s, OP_CLOSE);
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = slot->fd;
+                slot->state = SLOT_CLOSE;
+            }
+            else {
+                slot->state = SLOT_FREE;
+            }
+            head++;
+        }
+    }
+
+    if (head < list->num) {
+        if (uring_abort(r, slots, inflight) != 0) {
+            return head; // keep the buffers, reads may still be writing to them
+        }
+        free(bufs);
+        return head;
+    }
+    // submit the last closes, nothing else is queued
+    while (r->to_submit) {
+        int ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, 0, 0, NULL, 0);
+        if (ret < 0 && errno != EINTR) {
+            break;
+        }
+        if (ret > 0) {
+            r->to_submit -= ret;
+        }
+    }
+    free(bufs);
+    return head;
+}
+
+#endif
+
+// reads every file in the list, in order, with many reads in flight if possible
+int ingest_files(const struct ingest_list_s *list, int use_uring, ingest_fn fn, void *ctx) {
+    size_t done = 0;
+#ifdef __NR_io_uring_setup
+    struct uring_s r;
+    if (use_uring && list->num > 1 && uring_setup(&r, INGEST_DEPTH * 2) == 0) {
+        done = ingest_uring(&r, list, fn, ctx);
+        uring_teardown(&r);
+    }
+#else
+    (void)use_uring;
+#endif
+    return ingest_pread(list, done, fn, ctx);
+}
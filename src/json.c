@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "outbuf.h"
+#include "json.h"
+
+static const char hexdigits[] = "0123456789abcdef";
+
+static void put_string(struct outbuf_s *ob, const char *s) {
+    // worst case every byte becomes \u00XX
+    char *p = outbuf_reserve(ob, 6 * strlen(s) + 2);
+    *p++ = '"';
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        }
+        else if (c < 0x20) {
+            *p++ = '\\';
+            *p++ = 'u';
+            *p++ = '0';
+            *p++ = '0';
+            *p++ = hexdigits[c >> 4];
+            *p++ = hexdigits[c & 15];
+        }
+        else {
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+    ob->len = p - ob->data;
+}
+
+// separator and key of the next member
+static void member(struct json_s *j, const char *key) {
+    uint32_t bit = 1u << j->depth;
+    if (j->nonempty & bit) {
+        outbuf_write(j->ob, ",", 1);
+    }
+    j->nonempty |= bit;
+    if (key) {
+        put_string(j->ob, key);
+        outbuf_write(j->ob, ":", 1);
+    }
+}
+
+static void open_level(struct json_s *j, const char *key, const char *bracket) {
+    member(j, key);
+    outbuf_write(j->ob, bracket, 1);
+    if (j->depth + 1 < JSON_MAX_DEPTH) {
+        j->depth++;
+    }
+    j->nonempty &= ~(1u << j->depth);
+}
+
+static void close_level(struct json_s *j, const char *bracket) {
+    outbuf_write(j->ob, bracket, 1);
+    if (j->depth > 0) {
+        j->depth--;
+    }
+}
+
+// one top level object, written out as one NDJSON line by json_end()
+void json_begin(struct json_s *j, struct outbuf_s *ob) {
+    j->ob = ob;
+    j->depth = 0;
+    j->nonempty = 0;
+    open_level(j, NULL, "{");
+}
+
+void json_end(struct json_s *j) {
+    close_level(j, "}");
+    outbuf_write(j->ob, "\n", 1);
+}
+
+void json_object(struct json_s *j, const char *key) {
+    open_level(j, key, "{");
+}
+
+void json_object_end(struct json_s *j) {
+    close_level(j, "}");
+}
+
+void json_array(struct json_s *j, const char *key) {
+    open_level(j, key, "[");
+}
+
+void json_array_end(struct json_s *j) {
+    close_level(j, "]");
+}
+
+void json_string(struct json_s *j, const char *key, const char *val) {
+    member(j, key);
+    put_string(j->ob, val);
+}
+
+void json_uint(struct json_s *j, const char *key, uint64_t val) {
+    char digits[20], *p;
+    int n = 0;
+    member(j, key);
+    do {
+        digits[n++] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    p = outbuf_reserve(j->ob, n);
+    j->ob->len += n;
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+}
+
+void json_bool(struct json_s *j, const char *key, int val) {
+    member(j, key);
+    outbuf_puts(j->ob, val ? "true" : "false");
+}
+
+void json_null(struct json_s *j, const char *key) {
+    member(j, key);
+    outbuf_puts(j->ob, "null");
+}
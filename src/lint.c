@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuinfo.h"
+#include "dumpfile.h"
+#include "ingest.h"
+#include "outbuf.h"
+#include "xlat.h"
+#include "mmumap.h"
+#include "taskpool.h"
+#include "json.h"
+#include "batch.h"
+#include "lint.h"
+#include "stats.h"
+
+/*
+One task per dump checks its translation tables against all rules.
+mmumap_lint() does the rules that look at table entries (runs of 16,
+missing L2 tables, reserved AP); the rules about what the tables map
+(writable and executable, aliases with different memory types) run over
+the translation index, whose regions are already coalesced.  Dumps are
+linted LINT_JOBS at a time; each dump with findings gets a row per rule
+in list order, and the counters are summed over the list for the
+closing table.
+*/
+
+static const struct {
+    const char *name;
+    const char *key;            // in JSON
+} rules[LINT_RULES] = {
+    { "unaligned supersection", "unaligned_supersection" },
+    { "inconsistent supersection", "inconsistent_supersection" },
+    { "unaligned large page", "unaligned_large_page" },
+    { "inconsistent large page", "inconsistent_large_page" },
+    { "table not in image", "table_not_in_image" },
+    { "reserved AP", "reserved_ap" },
+    { "writable+executable", "writable_executable" },
+    { "memtype alias", "memtype_alias" },
+};
+
+struct lint_alias_s {
+    uint64_t pa, end;
+    uint32_t va;
+    const char *memtype;
+};
+
+// scratch of one worker, reused from dump to dump
+struct lint_worker_s {
+    struct xlat_s index;
+    struct lint_alias_s *alias, *sorted;
+    unsigned cap;
+};
+
+struct lint_s;
+
+struct lint_job_s {
+    struct lint_s *l;
+    const char *path;
+    uint32_t buf[INGEST_BUF_SIZE / 4];  // copy of the file, unless it is mapped
+    struct dumpfile_s df;
+    int err;
+    int map_err;
+    struct lint_dump_s d;
+};
+
+struct lint_s {
+    const struct batch_opts_s *opts;
+    struct taskpool_s *pool;
+    struct lint_worker_s *workers;
+    struct lint_job_s *jobs;
+    unsigned num_jobs;
+    uint64_t total[LINT_RULES];
+    size_t flagged[LINT_RULES];         // dumps with findings of the rule
+    size_t num_dumps, num_linted, num_flagged;
+    struct outbuf_s out;
+    int failed;
+};
+
+void lint_report(struct lint_dump_s *d, unsigned rule, uint32_t va, uint64_t n) {
+    if (d->count[rule] == 0 || va < d->first_va[rule]) {
+        d->first_va[rule] = va;
+    }
+    d->count[rule] += n;
+}
+
+#define RADIX_BITS 11
+#define RADIX_PASSES 3          // PA bits 12..44, past the 40 bits of LPAE
+
+// stable LSD radix sort by PA, regions are 4 KB aligned; a full map has
+// 100k+ regions, which qsort takes several times longer for.  Returns
+// whichever of a and tmp holds the result
+static struct lint_alias_s *sort_by_pa(struct lint_alias_s *a, struct lint_alias_s *tmp, unsigned num) {
+    unsigned count[1 << RADIX_BITS];
+    unsigned pass, n, b, sum;
+    for (pass = 0; pass < RADIX_PASSES; pass++) {
+        unsigned shift = 12 + pass * RADIX_BITS;
+        struct lint_alias_s *t;
+        memset(count, 0, sizeof(count));
+        for (n = 0; n < num; n++) {
+            count[(a[n].pa >> shift) & ((1 << RADIX_BITS) - 1)]++;
+        }
+        if (num == 0 || count[(a[0].pa >> shift) & ((1 << RADIX_BITS) - 1)] == num) {
+            continue; // one digit for all, the pass would not move anything
+        }
+        for (b = 0, sum = 0; b < (1 << RADIX_BITS); b++) {
+            unsigned c = count[b];
+            count[b] = sum;
+            sum += c;
+        }
+        for (n = 0; n < num; n++) {
+            tmp[count[(a[n].pa >> shift) & ((1 << RADIX_BITS) - 1)]++] = a[n];
+        }
+        t = a;
+        a = tmp;
+        tmp = t;
+    }
+    return a;
+}
+
+// the rules about the mappings, over the coalesced regions
+static void lint_index(struct lint_worker_s *w, struct lint_dump_s *d) {
+    const struct xlat_s *x = &w->index;
+    const struct lint_alias_s *a, *open;
+    char caching[40];
+    unsigned n;
+
+    if (x->num > w->cap) {
+        free(w->alias);
+        free(w->sorted);
+        w->cap = x->num;
+        w->alias = malloc(w->cap * sizeof(*w->alias));
+        w->sorted = malloc(w->cap * sizeof(*w->sorted));
+        if (w->alias == NULL || w->sorted == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+    }
+    for (n = 0; n < x->num; n++) {
+        const struct xlat_region_s *r = &x->regions[n];
+        const char *perm = xlat_effperm(x, &r->attr);
+        if (perm[1] == 'W' && !r->attr.xn && !r->attr.pxn) {
+            lint_report(d, LINT_WRITABLE_EXEC, r->va, 1);
+        }
+        w->alias[n].pa = r->pa;
+        w->alias[n].end = r->pa + r->size;
+        w->alias[n].va = r->va;
+        xlat_memattr(&r->attr, x->mair, &x->remap, caching, &w->alias[n].memtype);
+    }
+    // one sweep in PA order: a region that starts before the furthest end so far
+    // aliases the region that reaches it, and is reported if their memtypes differ
+    a = sort_by_pa(w->alias, w->sorted, x->num);
+    for (n = 0, open = NULL; n < x->num; n++) {
+        if (open && a[n].pa < open->end && strcmp(a[n].memtype, open->memtype) != 0) {
+            lint_report(d, LINT_MEMTYPE_ALIAS, a[n].va, 1);
+        }
+        if (open == NULL || a[n].end > open->end) {
+            open = &a[n];
+        }
+    }
+}
+
+static void lint_task(void *arg, unsigned worker) {
+    struct lint_job_s *job = arg;
+    struct lint_worker_s *w = &job->l->workers[worker];
+    struct mmumap_s m;
+
+    STATS_TIMER(t);
+    job->map_err = mmumap_init_vmsa(&m, &job->df);
+    if (job->map_err != 0) {
+        return;
+    }
+    mmumap_lint(&m, &job->d);
+    xlat_reset(&w->index);
+    mmumap_index(&m, 0, MMUMAP_L1_ENTRIES, &w->index);
+    lint_index(w, &job->d);
+    STATS_STOP(STAT_LINT, t, 0);
+}
+
+static void write_job(struct lint_s *l, const struct lint_job_s *job) {
+    struct json_s j;
+    unsigned r;
+    int found = 0;
+
+    l->num_linted++;
+    for (r = 0; r < LINT_RULES; r++) {
+        if (job->d.count[r] == 0) {
+            continue;
+        }
+        l->total[r] += job->d.count[r];
+        l->flagged[r]++;
+        if (l->opts->json) {
+            if (!found) {
+                json_begin(&j, &l->out);
+                json_string(&j, "path", job->path);
+                json_object(&j, "findings");
+            }
+            json_object(&j, rules[r].key);
+            json_uint(&j, "count", job->d.count[r]);
+            json_uint(&j, "first_va", job->d.first_va[r]);
+            json_object_end(&j);
+        }
+        else {
+            outbuf_printf(&l->out, "%s,%s,%llu,0x%08X\n", job->path, rules[r].name,
+                          (unsigned long long)job->d.count[r], job->d.first_va[r]);
+        }
+        found = 1;
+    }
+    if (found) {
+        l->num_flagged++;
+        if (l->opts->json) {
+            json_object_end(&j);
+            json_end(&j);
+        }
+    }
+}
+
+static void flush_jobs(struct lint_s *l) {
+    unsigned i;
+    size_t bytes;
+    taskpool_wait(l->pool);
+    STATS_TIMER(t);
+    for (i = 0; i < l->num_jobs; i++) {
+        struct lint_job_s *job = &l->jobs[i];
+        if (job->err == DUMPFILE_OK) {
+            job->err = dumpfile_error(&job->df);
+        }
+        if (job->err != DUMPFILE_OK) {
+            fprintf(stderr, "%s: %s\n", job->path, dumpfile_strerror(job->err));
+            l->failed = 1;
+            dumpfile_close(&job->df);
+            continue;
+        }
+        if (job->map_err == 0) {
+            write_job(l, job);
+        }
+        dumpfile_close(&job->df);
+    }
+    bytes = l->out.len;
+    outbuf_flush(&l->out, stdout);
+    STATS_STOP(STAT_WRITE, t, bytes);
+    l->num_jobs = 0;
+}
+
+static void ingest_dump(void *ctx, size_t index, const char *path,
+                        const void *buf, size_t len, int status) {
+    struct lint_s *l = ctx;
+    struct lint_job_s *job = &l->jobs[l->num_jobs++];
+    (void)index;
+
+    l->num_dumps++;
+    job->path = path;
+    job->map_err = 0;
+    job->df.map = NULL;
+    job->df.lazy = NULL;
+    memset(&job->d, 0, sizeof(job->d));
+    if (status < 0) {
+        job->err = DUMPFILE_ERR_IO;
+    }
+    else if (status == INGEST_PARTIAL || dumpfile_is_compressed(buf, len)) {
+        job->err = dumpfile_open(path, l->opts->raw_layout, &job->df);
+    }
+    else {
+        memcpy(job->buf, buf, len);
+        job->err = dumpfile_parse(job->buf, len, l->opts->raw_layout, &job->df);
+    }
+    if (job->err == DUMPFILE_OK) {
+        taskpool_submit(l->pool, lint_task, job);
+    }
+    if (l->num_jobs == LINT_JOBS) {
+        flush_jobs(l);
+    }
+}
+
+static void write_totals(const struct lint_s *l, struct outbuf_s *ob) {
+    struct json_s j;
+    unsigned r;
+
+    if (l->opts->json) {
+        json_begin(&j, ob);
+        json_uint(&j, "dumps", l->num_dumps);
+        json_uint(&j, "linted", l->num_linted);
+        json_uint(&j, "flagged", l->num_flagged);
+        json_object(&j, "rules");
+        for (r = 0; r < LINT_RULES; r++) {
+            json_object(&j, rules[r].key);
+            json_uint(&j, "findings", l->total[r]);
+            json_uint(&j, "dumps", l->flagged[r]);
+            json_object_end(&j);
+        }
+        json_object_end(&j);
+        json_end(&j);
+        return;
+    }
+    outbuf_printf(ob, "# %zu dumps, %zu with tables, %zu with findings\n",
+                  l->num_dumps, l->num_linted, l->num_flagged);
+    outbuf_puts(ob, "Rule,Findings,Dumps\n");
+    for (r = 0; r < LINT_RULES; r++) {
+        outbuf_printf(ob, "%s,%llu,%zu\n", rules[r].name, (unsigned long long)l->total[r], l->flagged[r]);
+    }
+}
+
+// -1 if a dump could not be read; dumps without tables in their images are only counted
+int lint_run(const struct batch_opts_s *opts, const struct ingest_list_s *list) {
+    struct lint_s l;
+    unsigned i, workers = opts->workers ? opts->workers : taskpool_default_workers();
+
+    memset(&l, 0, sizeof(l));
+    l.opts = opts;
+    l.jobs = malloc(LINT_JOBS * sizeof(struct lint_job_s));
+    l.workers = calloc(workers, sizeof(struct lint_worker_s));
+    if (l.jobs == NULL || l.workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    for (i = 0; i < LINT_JOBS; i++) {
+        l.jobs[i].l = &l;
+    }
+    for (i = 0; i < workers; i++) {
+        xlat_init(&l.workers[i].index);
+    }
+    outbuf_init(&l.out);
+    l.pool = taskpool_create(workers);
+
+    if (!opts->json) {
+        outbuf_puts(&l.out, "Dump,Rule,Findings,First VA\n");
+    }
+    ingest_files(list, opts->use_uring, ingest_dump, &l);
+    flush_jobs(&l);
+    write_totals(&l, &l.out);
+    outbuf_flush(&l.out, stdout);
+    fflush(stdout);
+
+    taskpool_destroy(l.pool);
+    for (i = 0; i < workers; i++) {
+        xlat_free(&l.workers[i].index);
+        free(l.workers[i].alias);
+        free(l.workers[i].sorted);
+    }
+    free(l.workers);
+    free(l.jobs);
+    outbuf_free(&l.out);
+    return l.failed ? -1 : 0;
+}
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dumpfile.h"
+#include "outbuf.h"
+#include "xlat.h"
+#include "mmumap.h"
+#include "lpae.h"
+#include "lint.h"
+#include "stats.h"
+
+/*
+Long-descriptor (LPAE) tables: 64 bit descriptors, up to three levels of
+lookup (1 GB, 2 MB and 4 KB) and 40 bit output addresses.  TTBCR.T0SZ and
+T1SZ split the VA space between TTBR0 and TTBR1, and decide whether the
+lookup starts at the first or the second level.
+
+The dump only holds the low words of the 64 bit TTBRs, so tables above
+4 GB can't be located; their output addresses are fine.  Walk rows use
+the csvhead columns of the short-descriptor map, with the next-level
+table in the L2 ref column.
+*/
+
+#define L1_BLOCK    0x40000000ULL
+#define L2_BLOCK    0x200000ULL
+#define PAGE        0x1000ULL
+#define OA_MASK     0xfffffff000ULL         // output or next table address, bits 39..12
+#define TABLE_BITS  0xf800000000000000ULL   // NSTable, APTable, XNTable, PXNTable
+
+enum {
+    DESC_FAULT,
+    DESC_BLOCK,         // block or page
+    DESC_TABLE,
+};
+
+int lpae_init(struct mmumap_s *m) {
+    uint32_t ttbcr = m->regs.ttbcr;
+    unsigned sz[2], r;
+
+    sz[0] = ttbcr & 7;
+    sz[1] = (ttbcr >> 16) & 7;
+    m->ttbr[0].va_first = 0;
+    m->ttbr[1].va_last = 0xffffffff;
+    if (sz[0] == 0 && sz[1] == 0) {
+        m->ttbr[0].va_last = 0xffffffff;
+        m->ttbr[1].va_first = 0xffffffff; // unused, level 0 below
+    }
+    else {
+        m->ttbr[1].va_first = sz[1] ? ~(0xffffffffu >> sz[1]) : 1u << (32 - sz[0]);
+        m->ttbr[0].va_last = sz[0] ? (1u << (32 - sz[0])) - 1 : m->ttbr[1].va_first - 1;
+    }
+    for (r = 0; r < 2; r++) {
+        struct mmumap_lpae_ttbr_s *t = &m->ttbr[r];
+        uint32_t ttbr = r ? m->regs.ttbr1 : m->regs.ttbr0;
+        int disabled = ttbcr & (r ? 0x800000 : 0x80); // EPD1, EPD0
+        t->level = sz[r] <= 1 ? 1 : 2;
+        t->entries = t->level == 1 ? 4 >> sz[r] : 2048 >> sz[r];
+        t->adr = ttbr & ~(t->entries * 8 - 1);
+        t->tbl = NULL;
+        if (disabled || (r == 1 && sz[0] == 0 && sz[1] == 0)) {
+            t->level = 0;
+            continue;
+        }
+        t->tbl = dumpfile_phys(m->df, t->adr, t->entries * 8);
+        if (t->tbl == NULL) {
+            return r ? MMUMAP_ERR_TT1 : MMUMAP_ERR_TT0;
+        }
+    }
+    return 0;
+}
+
+static unsigned desc_type(uint64_t d, unsigned level) {
+    switch (d & 3) {
+        case 1: return level < 3 ? DESC_BLOCK : DESC_FAULT;
+        case 3: return level < 3 ? DESC_TABLE : DESC_BLOCK;
+    }
+    return DESC_FAULT;
+}
+
+// tblattr: the TABLE_BITS of the table descriptors above, which can only take permissions away
+static void desc_attr(uint64_t d, uint64_t tblattr, struct xlat_attr_s *a) {
+    // AP[2:1] as the APX:AP[1:0] of the same access: RW/--, RW/RW, R-/--, R-/R-
+    static const uint8_t apx_ap[] = { 1, 3, 5, 6 };
+    unsigned ap2 = ((d >> 7) | (tblattr >> 62)) & 1;
+    unsigned ap1 = (d >> 6) & ~(tblattr >> 61) & 1;
+    memset(a, 0, sizeof(*a));
+    a->format = XLAT_LONG;
+    a->ap = apx_ap[(ap2 << 1) | ap1];
+    a->xn = ((d >> 54) | (tblattr >> 60)) & 1;
+    a->pxn = ((d >> 53) | (tblattr >> 59)) & 1;
+    a->domain = XLAT_NO_DOMAIN;
+    a->memattr = (d >> 2) & 7;
+    a->shareable = (d >> 8) & 3;
+    a->ng = (d >> 11) & 1;
+    a->ns = ((d >> 5) | (tblattr >> 63)) & 1;
+}
+
+// one walk row after its "0x%08X,Ln," prefix, in csvhead columns; returns the DESC_ type
+static unsigned interpret_entry(const struct mmumap_s *m, uint64_t d, unsigned level,
+                                uint64_t tblattr, char *buf) {
+    static const uint64_t oa_mask[] = { 0, 0xffc0000000ULL, 0xffffe00000ULL, OA_MASK };
+    struct xlat_attr_s a;
+    char caching[40];
+    const char *memtype;
+    unsigned typ = desc_type(d, level);
+
+    switch (typ) {
+        case DESC_FAULT:
+            sprintf(buf, "Fault,");
+            break;
+        case DESC_TABLE:
+            sprintf(buf, "Table,,,,,0x%010llX,,,,,,", (unsigned long long)(d & OA_MASK));
+            break;
+        default:
+            desc_attr(d, tblattr, &a);
+            xlat_memattr(&a, m->mair, NULL, caching, &memtype);
+            sprintf(buf, "%s,,%s,,0x%010llX,,%s,%s,%s,%s,%s,", level < 3 ? "Block" : "Page",
+                    a.ng ? "Nonglobal" : "Global", (unsigned long long)(d & oa_mask[level]),
+                    xlat_shareable(&a), cpuinfo_accperm(a.ap), caching, memtype, xlat_xn(&a));
+    }
+    return typ;
+}
+
+static const uint64_t *next_table(const struct mmumap_s *m, uint64_t d) {
+    return dumpfile_phys(m->df, d & OA_MASK, MMUMAP_LPAE_ENTRIES * 8);
+}
+
+static void walk_level3(const struct mmumap_s *m, const uint64_t *tbl, uint64_t tblattr,
+                        uint32_t va, struct outbuf_s *ob) {
+    char buf[256];
+    unsigned n;
+    for (n = 0; n < MMUMAP_LPAE_ENTRIES; n++, va += PAGE) {
+        outbuf_printf(ob, "0x%08X,L3,", va);
+        STATS_TIMER(t);
+        interpret_entry(m, tbl[n], 3, tblattr, buf);
+        STATS_STOP(STAT_L2, t, 0);
+        outbuf_puts(ob, buf);
+        mmumap_row_end(m, va, "\n", ob);
+    }
+}
+
+// rows of the 2 MB slots that start in [lo, hi)
+static void walk_level2(const struct mmumap_s *m, const uint64_t *tbl, unsigned entries,
+                        uint64_t tblattr, uint64_t lo, uint64_t hi, struct outbuf_s *ob) {
+    char buf[256];
+    uint64_t va;
+    for (va = (lo + L2_BLOCK - 1) & ~(L2_BLOCK - 1); va < hi; va += L2_BLOCK) {
+        uint64_t d = tbl[(va >> 21) & (entries - 1)];
+        unsigned typ;
+        outbuf_printf(ob, "0x%08X,L2,", (uint32_t)va);
+        STATS_TIMER(t);
+        typ = interpret_entry(m, d, 2, tblattr, buf);
+        STATS_STOP(STAT_L1, t, 0);
+        outbuf_puts(ob, buf);
+        if (typ == DESC_TABLE) {
+            const uint64_t *next = next_table(m, d);
+            if (next == NULL) {
+                mmumap_row_end(m, (uint32_t)va, "ERR: L3 table not in image\n", ob);
+                continue;
+            }
+            mmumap_row_end(m, (uint32_t)va, "\n", ob);
+            walk_level3(m, next, tblattr | (d & TABLE_BITS), va, ob);
+        }
+        else {
+            mmumap_row_end(m, (uint32_t)va, "\n", ob);
+        }
+    }
+}
+
+// an L1 row goes with the lowest VA its entry translates, which is where a chunk can start
+static void walk_level1(const struct mmumap_s *m, const struct mmumap_lpae_ttbr_s *t,
+                        uint64_t lo, uint64_t hi, struct outbuf_s *ob) {
+    char buf[256];
+    uint64_t g;
+    for (g = lo & ~(L1_BLOCK - 1); g < hi; g += L1_BLOCK) {
+        uint64_t first = g < t->va_first ? t->va_first : g;
+        uint64_t d = t->tbl[(g >> 30) & (t->entries - 1)];
+        unsigned typ;
+        if (first >= lo) {
+            outbuf_printf(ob, "0x%08X,L1,", (uint32_t)first);
+            STATS_TIMER(tm);
+            typ = interpret_entry(m, d, 1, 0, buf);
+            STATS_STOP(STAT_L1, tm, 0);
+            outbuf_puts(ob, buf);
+            if (typ == DESC_TABLE && next_table(m, d) == NULL) {
+                mmumap_row_end(m, (uint32_t)first, "ERR: L2 table not in image\n", ob);
+                continue;
+            }
+            mmumap_row_end(m, (uint32_t)first, "\n", ob);
+        }
+        if (desc_type(d, 1) == DESC_TABLE && next_table(m, d) != NULL) {
+            walk_level2(m, next_table(m, d), MMUMAP_LPAE_ENTRIES, d & TABLE_BITS,
+                        lo > first ? lo : first, hi < g + L1_BLOCK ? hi : g + L1_BLOCK, ob);
+        }
+    }
+}
+
+// rows for VAs in [va, end), in VA order; walking in chunks gives the same output
+void lpae_walk(const struct mmumap_s *m, uint32_t va, uint64_t end, struct outbuf_s *ob) {
+    unsigned r;
+    for (r = 0; r < 2; r++) {
+        const struct mmumap_lpae_ttbr_s *t = &m->ttbr[r];
+        uint64_t lo = va > t->va_first ? va : t->va_first;
+        uint64_t hi = end < (uint64_t)t->va_last + 1 ? end : (uint64_t)t->va_last + 1;
+        if (t->level == 0 || lo >= hi) {
+            continue;
+        }
+        if (t->level == 1) {
+            walk_level1(m, t, lo, hi, ob);
+        }
+        else {
+            walk_level2(m, t->tbl, t->entries, 0, lo, hi, ob);
+        }
+    }
+}
+
+// lpae_walk() without the output: how many rows it writes for [va, end)
+static size_t rows_level2(const struct mmumap_s *m, const uint64_t *tbl, unsigned entries,
+                          uint64_t lo, uint64_t hi) {
+    size_t rows = 0;
+    uint64_t va;
+    for (va = (lo + L2_BLOCK - 1) & ~(L2_BLOCK - 1); va < hi; va += L2_BLOCK) {
+        uint64_t d = tbl[(va >> 21) & (entries - 1)];
+        rows++;
+        if (desc_type(d, 2) == DESC_TABLE && next_table(m, d) != NULL) {
+            rows += MMUMAP_LPAE_ENTRIES;
+        }
+    }
+    return rows;
+}
+
+size_t lpae_rows(const struct mmumap_s *m, uint32_t va, uint64_t end) {
+    size_t rows = 0;
+    unsigned r;
+    for (r = 0; r < 2; r++) {
+        const struct mmumap_lpae_ttbr_s *t = &m->ttbr[r];
+        uint64_t lo = va > t->va_first ? va : t->va_first;
+        uint64_t hi = end < (uint64_t)t->va_last + 1 ? end : (uint64_t)t->va_last + 1;
+        uint64_t g;
+        if (t->level == 0 || lo >= hi) {
+            continue;
+        }
+        if (t->level == 2) {
+            rows += rows_level2(m, t->tbl, t->entries, lo, hi);
+            continue;
+        }
+        for (g = lo & ~(L1_BLOCK - 1); g < hi; g += L1_BLOCK) {
+            uint64_t first = g < t->va_first ? t->va_first : g;
+            uint64_t d = t->tbl[(g >> 30) & (t->entries - 1)];
+            rows += first >= lo;
+            if (desc_type(d, 1) == DESC_TABLE && next_table(m, d) != NULL) {
+                rows += rows_level2(m, next_table(m, d), MMUMAP_LPAE_ENTRIES,
+                                    lo > first ? lo : first, hi < g + L1_BLOCK ? hi : g + L1_BLOCK);
+            }
+        }
+    }
+    return rows;
+}
+
+static void index_level3(const uint64_t *tbl, uint64_t tblattr, uint32_t va, struct xlat_s *x) {
+    struct xlat_attr_s a;
+    unsigned n = 0, run;
+    while (n < MMUMAP_LPAE_ENTRIES) {
+        if (desc_type(tbl[n], 3) != DESC_BLOCK) {
+            n++;
+            continue;
+        }
+        run = xlat_run64(tbl + n, MMUMAP_LPAE_ENTRIES - n, PAGE);
+        desc_attr(tbl[n], tblattr, &a);
+        xlat_add(x, va + n * PAGE, tbl[n] & OA_MASK, run * PAGE, &a);
+        n += run;
+    }
+}
+
+static void index_level2(const struct mmumap_s *m, const uint64_t *tbl, unsigned entries,
+                         uint64_t tblattr, uint64_t lo, uint64_t hi, struct xlat_s *x) {
+    struct xlat_attr_s a;
+    uint64_t va = (lo + L2_BLOCK - 1) & ~(L2_BLOCK - 1);
+    while (va < hi) {
+        unsigned idx = (va >> 21) & (entries - 1);
+        uint64_t d = tbl[idx];
+        unsigned run = 1, slots;
+        const uint64_t *next;
+        switch (desc_type(d, 2)) {
+            case DESC_BLOCK:
+                slots = (hi - va + L2_BLOCK - 1) >> 21;
+                run = xlat_run64(tbl + idx, slots < entries - idx ? slots : entries - idx, L2_BLOCK);
+                desc_attr(d, tblattr, &a);
+                xlat_add(x, va, d & 0xffffe00000ULL, run * L2_BLOCK, &a);
+                break;
+            case DESC_TABLE:
+                next = next_table(m, d);
+                if (next != NULL) {
+                    index_level3(next, tblattr | (d & TABLE_BITS), va, x);
+                }
+                break;
+        }
+        va += run * L2_BLOCK;
+    }
+}
+
+// adds the mappings of VAs in [va, end) to x, see mmumap_index()
+void lpae_index(const struct mmumap_s *m, uint32_t va, uint64_t end, struct xlat_s *x) {
+    struct xlat_attr_s a;
+    unsigned r;
+    for (r = 0; r < 2; r++) {
+        const struct mmumap_lpae_ttbr_s *t = &m->ttbr[r];
+        uint64_t lo = va > t->va_first ? va : t->va_first;
+        uint64_t hi = end < (uint64_t)t->va_last + 1 ? end : (uint64_t)t->va_last + 1;
+        uint64_t g;
+        if (t->level == 0 || lo >= hi) {
+            continue;
+        }
+        if (t->level == 2) {
+            index_level2(m, t->tbl, t->entries, 0, lo, hi, x);
+            continue;
+        }
+        for (g = lo & ~(L1_BLOCK - 1); g < hi; g += L1_BLOCK) {
+            uint64_t d = t->tbl[(g >> 30) & (t->entries - 1)];
+            uint64_t first = lo > g ? lo : g;
+            uint64_t last = hi < g + L1_BLOCK ? hi : g + L1_BLOCK;
+            const uint64_t *next;
+            switch (desc_type(d, 1)) {
+                case DESC_BLOCK:
+                    desc_attr(d, 0, &a);
+                    xlat_add(x, first, (d & 0xffc0000000ULL) + (first - g), last - first, &a);
+                    break;
+                case DESC_TABLE:
+                    next = next_table(m, d);
+                    if (next != NULL) {
+                        index_level2(m, next, MMUMAP_LPAE_ENTRIES, d & TABLE_BITS, first, last, x);
+                    }
+                    break;
+            }
+        }
+    }
+}
+
+// the only table rule of lint.h for long descriptors: next-level tables outside the images
+static void lint_level2(const struct mmumap_s *m, const uint64_t *tbl, unsigned entries,
+                        uint64_t lo, uint64_t hi, struct lint_dump_s *d) {
+    uint64_t va;
+    for (va = lo; va < hi; va += L2_BLOCK) {
+        uint64_t e = tbl[(va >> 21) & (entries - 1)];
+        if (desc_type(e, 2) == DESC_TABLE && next_table(m, e) == NULL) {
+            lint_report(d, LINT_TABLE_NOT_IN_IMAGE, (uint32_t)va, 1);
+        }
+    }
+}
+
+void lpae_lint(const struct mmumap_s *m, struct lint_dump_s *d) {
+    unsigned r;
+    for (r = 0; r < 2; r++) {
+        const struct mmumap_lpae_ttbr_s *t = &m->ttbr[r];
+        uint64_t hi = (uint64_t)t->va_last + 1, g;
+        if (t->level == 0) {
+            continue;
+        }
+        if (t->level == 2) {
+            lint_level2(m, t->tbl, t->entries, t->va_first, hi, d);
+            continue;
+        }
+        for (g = t->va_first & ~(L1_BLOCK - 1); g < hi; g += L1_BLOCK) {
+            uint64_t first = g < t->va_first ? t->va_first : g;
+            uint64_t e = t->tbl[(g >> 30) & (t->entries - 1)];
+            if (desc_type(e, 1) != DESC_TABLE) {
+                continue;
+            }
+            if (next_table(m, e) == NULL) {
+                lint_report(d, LINT_TABLE_NOT_IN_IMAGE, (uint32_t)first, 1);
+            }
+            else {
+                lint_level2(m, next_table(m, e), MMUMAP_LPAE_ENTRIES, first,
+                            g + L1_BLOCK < hi ? g + L1_BLOCK : hi, d);
+            }
+        }
+    }
+}
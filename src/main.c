@@ -1,32 +1,553 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cpuinfo.h"
+#include "dumpfile.h"
+#include "ingest.h"
+#include "batch.h"
+#include "stats.h"
+#include "taskpool.h"
+#include "ptscan.h"
+#include "query.h"
+#include "group.h"
+#include "columns.h"
+#include "lint.h"
+#include "cluster.h"
+#include "symtab.h"
+#include "watch.h"
+#include "zread.h"
+#include "outbuf.h"
+#include "mmumap.h"
+#include "mapout.h"
+
+#define MAX_IMAGES 16
 
 void print_usage(void)
 {
     printf("Typical usage: ./parser cpuinfo_r6.dat\n");
+    printf("       ./parser [options] FILE|DIR...\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  --layout NAME      register layout of raw dumps: pmsa, vmsa (default vmsa)\n");
+    printf("  --pack OUT         write FILE as a framed dump container to OUT\n");
+    printf("  --image ADDR:FILE  with --pack, append a RAM image loaded at physical ADDR\n");
+    printf("  --no-uring         read batches with blocking reads instead of io_uring\n");
+    printf("  --map              append the MMU map (CSV) of VMSA dumps that carry RAM images\n");
+    printf("  --map-out OUT      write the MMU map (CSV) of FILE to OUT, formatted in place by the workers\n");
+    printf("  --regions          append the translation regions, runs of pages/sections merged\n");
+    printf("  --translate VA     append the physical address and attributes of virtual address VA\n");
+    printf("  --symbols FILE     name the symbol or section at each VA of the map, regions and translation;\n");
+    printf("                     FILE has \"ADDR [SIZE] [TYPE] NAME\" lines, as from nm -S\n");
+    printf("  --json             one JSON object per dump and line (NDJSON); --map gives its regions\n");
+    printf("  --query PATH       print only field PATH, as Word.Field or Word; repeat or separate with ;\n");
+    printf("  --group            count dumps per class of equal registers, decode one per class\n");
+    printf("  --mask WORD        with --group, ignore register WORD; repeat or separate with ;\n");
+    printf("                     (default: DBGDSCR and Multiprocessor ID)\n");
+    printf("  --hist             with --query, count the values of each field over all dumps\n");
+    printf("  --csv              with --query, write the fields of all dumps as CSV, one row per dump\n");
+    printf("  --cluster          merge per-core dumps by Multiprocessor ID: decode each cluster once,\n");
+    printf("                     list what other cores differ in, walk each distinct table once\n");
+    printf("  --lint             check the translation tables of all dumps, count findings per rule\n");
+    printf("  --watch DIR        decode dumps as they are written into DIR, until interrupted\n");
+    printf("  --out-dir OUT      with --watch, write each dump's output to OUT/NAME.txt (.json)\n");
+    printf("  --decoder NAME     register decoder: gen (generated, default) or table\n");
+    printf("  --bench N          decode FILE N times with each decoder and compare their speed\n");
+    printf("  -j, --jobs N       worker threads (default: one per CPU)\n");
+    printf("  --stats[=json]     print per-stage counters and timings to stderr at exit\n");
+    printf("  --scan-ram ADDR:FILE  search a raw RAM image loaded at physical ADDR for L1 tables\n");
 }
 
-int main(int argc, char **argv)
+static void *map_file(const char *path, size_t *size)
 {
-    if (argc != 2)
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || (off_t)(size_t)st.st_size != st.st_size)
     {
-        print_usage();
-        return -1;
+        close(fd);
+        return NULL;
+    }
+    *size = st.st_size;
+    map = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED && zread_detect(map, st.st_size) != ZREAD_NONE)
+    {
+        // compressed RAM image, inflated into anonymous memory instead of a temp file
+        int codec = zread_detect(map, st.st_size);
+        munmap(map, st.st_size ? st.st_size : 1);
+        return zread_load(fd, codec, size);
     }
+    close(fd);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+// --pack: wrap a dump, raw or framed, with any given images into a new container
+static int pack_dump(const struct dumpfile_s *df, const char *out,
+                     const char **image_args, int num_images)
+{
+    struct dumpfile_image_s images[MAX_IMAGES];
+    const void *image_data[MAX_IMAGES];
+    uint32_t n;
+    int i, ret;
 
-    // get saved info dumped from cam, typically CPUINFO.DAT
-    FILE *fp = NULL;
-    const size_t num_cpuinfo_words = get_num_cpuinfo_words();
-    uint32_t cpuinfo[num_cpuinfo_words];
-    fp = fopen(argv[1], "rb");
+    // images already in the source container are carried over
+    for (n = 0; n < df->num_images && n < MAX_IMAGES; n++)
+    {
+        images[n] = df->images[n];
+        image_data[n] = dumpfile_image(df, n);
+        if (image_data[n] == NULL)
+        {
+            fprintf(stderr, "Cannot read image %u of the dump\n", n);
+            return -1;
+        }
+    }
+    for (i = 0; i < num_images && n < MAX_IMAGES; i++, n++)
+    {
+        char *sep;
+        size_t size;
+        images[n].phys_addr = strtoull(image_args[i], &sep, 0);
+        if (*sep != ':')
+        {
+            fprintf(stderr, "Bad --image argument %s, expected ADDR:FILE\n", image_args[i]);
+            return -1;
+        }
+        image_data[n] = map_file(sep + 1, &size);
+        if (image_data[n] == NULL)
+        {
+            fprintf(stderr, "Cannot read image %s\n", sep + 1);
+            return -1;
+        }
+        images[n].size = size;
+    }
+
+    FILE *fp = fopen(out, "wb");
     if (fp == NULL)
         return -1;
-    fread(cpuinfo, sizeof(uint32_t), num_cpuinfo_words, fp);
+    ret = dumpfile_write(fp, df->layout, df->words, df->num_words, images, image_data, n);
+    if (fclose(fp) != 0 && ret == DUMPFILE_OK)
+        ret = DUMPFILE_ERR_IO;
+    if (ret != DUMPFILE_OK)
+    {
+        fprintf(stderr, "%s: %s\n", out, dumpfile_strerror(ret));
+        return -1;
+    }
+    return 0;
+}
 
-    // write out description
-    cpuinfo_write_file(cpuinfo);
+// --scan-ram: rank 16 KB aligned offsets of a RAM image by how much they look like an L1 table
+static int scan_ram(const char *arg, unsigned workers)
+{
+    struct ptscan_hit_s hits[PTSCAN_MAX_HITS];
+    struct taskpool_s *pool;
+    unsigned num_hits;
+    uint64_t base;
+    size_t size;
+    char *sep;
+    void *data;
 
+    base = strtoull(arg, &sep, 0);
+    if (*sep != ':')
+    {
+        fprintf(stderr, "Bad --scan-ram argument %s, expected ADDR:FILE\n", arg);
+        return -1;
+    }
+    data = map_file(sep + 1, &size);
+    if (data == NULL)
+    {
+        fprintf(stderr, "Cannot read image %s\n", sep + 1);
+        return -1;
+    }
+    pool = taskpool_create(workers ? workers : taskpool_default_workers());
+    num_hits = ptscan_image(pool, base, data, size, hits, PTSCAN_MAX_HITS);
+    taskpool_destroy(pool);
+    munmap(data, size ? size : 1);
+    ptscan_print(stdout, hits, num_hits);
     return 0;
 }
+
+// --map-out: one dump's map into a file of its own
+static int map_out(const char *path, unsigned raw_layout, const struct symtab_s *syms,
+                   const char *out, unsigned workers)
+{
+    struct taskpool_s *pool;
+    struct dumpfile_s df;
+    struct mmumap_s m;
+    int ret;
+
+    ret = dumpfile_open(path, raw_layout, &df);
+    if (ret != DUMPFILE_OK)
+    {
+        fprintf(stderr, "%s: %s\n", path, dumpfile_strerror(ret));
+        return -1;
+    }
+    ret = mmumap_init_vmsa(&m, &df);
+    if (ret != 0)
+    {
+        fprintf(stderr, "%s: MMU map: %s\n", path, mmumap_strerror(ret));
+        dumpfile_close(&df);
+        return -1;
+    }
+    m.syms = syms;
+    pool = taskpool_create(workers ? workers : taskpool_default_workers());
+    ret = mapout_write(&m, out, pool);
+    taskpool_destroy(pool);
+    if (ret < 0)
+        fprintf(stderr, "Cannot write %s\n", out);
+    else if (dumpfile_error(&df) != DUMPFILE_OK)
+    {
+        fprintf(stderr, "%s: %s\n", path, dumpfile_strerror(dumpfile_error(&df)));
+        ret = -1;
+    }
+    dumpfile_close(&df);
+    return ret;
+}
+
+static double decode_ns(const struct dumpfile_s *df, int decoder, unsigned iters, struct outbuf_s *ob)
+{
+    struct timespec t0, t1;
+    unsigned i;
+    cpuinfo_set_decoder(decoder);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < iters; i++)
+    {
+        outbuf_reset(ob);
+        cpuinfo_format(ob, df->words, df->layout);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / iters;
+}
+
+// --bench: the generated decoders against the table interpreter, on one dump
+static int bench_decoders(const char *path, unsigned raw_layout, unsigned iters)
+{
+    struct outbuf_s table, gen;
+    struct dumpfile_s df;
+    double t_table, t_gen;
+    int ret;
+
+    ret = dumpfile_open(path, raw_layout, &df);
+    if (ret != DUMPFILE_OK)
+    {
+        fprintf(stderr, "%s: %s\n", path, dumpfile_strerror(ret));
+        return -1;
+    }
+    outbuf_init(&table);
+    outbuf_init(&gen);
+    if (iters == 0)
+        iters = 1;
+    t_table = decode_ns(&df, CPUINFO_DECODER_TABLE, iters, &table);
+    t_gen = decode_ns(&df, CPUINFO_DECODER_GENERATED, iters, &gen);
+    ret = table.len == gen.len && memcmp(table.data, gen.data, gen.len) == 0 ? 0 : -1;
+    printf("table     %10.1f ns/dump\n", t_table);
+    printf("generated %10.1f ns/dump  %.2fx\n", t_gen, t_table / t_gen);
+    printf("output    %s\n", ret == 0 ? "identical" : "DIFFERS");
+    outbuf_free(&table);
+    outbuf_free(&gen);
+    dumpfile_close(&df);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        {"layout", required_argument, NULL, 'l'},
+        {"pack", required_argument, NULL, 'p'},
+        {"image", required_argument, NULL, 'i'},
+        {"no-uring", no_argument, NULL, 'U'},
+        {"map", no_argument, NULL, 'm'},
+        {"map-out", required_argument, NULL, 'o'},
+        {"regions", no_argument, NULL, 'r'},
+        {"translate", required_argument, NULL, 't'},
+        {"query", required_argument, NULL, 'q'},
+        {"symbols", required_argument, NULL, 'Y'},
+        {"json", no_argument, NULL, 'J'},
+        {"group", no_argument, NULL, 'g'},
+        {"mask", required_argument, NULL, 'M'},
+        {"watch", required_argument, NULL, 'W'},
+        {"out-dir", required_argument, NULL, 'O'},
+        {"hist", no_argument, NULL, 'H'},
+        {"csv", no_argument, NULL, 'C'},
+        {"lint", no_argument, NULL, 'L'},
+        {"cluster", no_argument, NULL, 'K'},
+        {"decoder", required_argument, NULL, 'D'},
+        {"bench", required_argument, NULL, 'B'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"stats", optional_argument, NULL, 'S'},
+        {"scan-ram", required_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {}
+    };
+    struct batch_opts_s opts = { CPUINFO_LAYOUT_VMSA, 1 };
+    const char *pack_out = NULL;
+    const char *map_out_path = NULL;
+    const char *image_args[MAX_IMAGES];
+    int num_images = 0;
+    int stats = 0;
+    const char *scan_arg = NULL;
+    int bench = 0;
+    unsigned bench_iters = 0;
+    const char *query_paths[QUERY_MAX_PATHS];
+    unsigned num_query = 0;
+    static struct query_s query;
+    const char *mask_words[GROUP_MAX_MASK];
+    unsigned num_mask = 0;
+    int group = 0;
+    int columns = 0;
+    int lint = 0;
+    int cluster = 0;
+    const char *symbols_path = NULL;
+    static struct symtab_s symbols;
+    const char *watch_dir = NULL;
+    const char *out_dir = NULL;
+    int opt, ret;
+
+    while ((opt = getopt_long(argc, argv, "hj:", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'l':
+            opts.raw_layout = cpuinfo_layout_by_name(optarg);
+            if (cpuinfo_get_desc(opts.raw_layout) == NULL)
+            {
+                fprintf(stderr, "Unsupported layout %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'p':
+            pack_out = optarg;
+            break;
+        case 'i':
+            if (num_images == MAX_IMAGES)
+            {
+                fprintf(stderr, "Too many images, max %d\n", MAX_IMAGES);
+                return -1;
+            }
+            image_args[num_images++] = optarg;
+            break;
+        case 'U':
+            opts.use_uring = 0;
+            break;
+        case 'm':
+            opts.map = 1;
+            break;
+        case 'o':
+            map_out_path = optarg;
+            break;
+        case 'r':
+            opts.regions = 1;
+            break;
+        case 't':
+            opts.translate = 1;
+            opts.translate_va = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            for (char *path = strtok(optarg, ";"); path; path = strtok(NULL, ";"))
+            {
+                if (num_query == QUERY_MAX_PATHS)
+                {
+                    fprintf(stderr, "Too many query paths, max %d\n", QUERY_MAX_PATHS);
+                    return -1;
+                }
+                query_paths[num_query++] = path;
+            }
+            break;
+        case 'Y':
+            symbols_path = optarg;
+            break;
+        case 'J':
+            opts.json = 1;
+            break;
+        case 'g':
+            group = 1;
+            break;
+        case 'H':
+            columns = COLUMNS_HIST;
+            break;
+        case 'C':
+            columns = COLUMNS_CSV;
+            break;
+        case 'L':
+            lint = 1;
+            break;
+        case 'K':
+            cluster = 1;
+            break;
+        case 'M':
+            for (char *word = strtok(optarg, ";"); word; word = strtok(NULL, ";"))
+            {
+                if (num_mask == GROUP_MAX_MASK)
+                {
+                    fprintf(stderr, "Too many masked words, max %d\n", GROUP_MAX_MASK);
+                    return -1;
+                }
+                mask_words[num_mask++] = word;
+            }
+            break;
+        case 'W':
+            watch_dir = optarg;
+            break;
+        case 'O':
+            out_dir = optarg;
+            break;
+        case 'j':
+        {
+            char *end;
+            unsigned long n = strtoul(optarg, &end, 10);
+            // strtoul would take "-1" as a huge count
+            if (end == optarg || *end || strchr(optarg, '-') || n == 0 || n > TASKPOOL_MAX_WORKERS)
+            {
+                fprintf(stderr, "Bad --jobs argument %s, expected 1 to %d\n", optarg, TASKPOOL_MAX_WORKERS);
+                return -1;
+            }
+            opts.workers = n;
+            break;
+        }
+        case 'S':
+            stats = optarg && strcmp(optarg, "json") == 0 ? 2 : 1;
+            stats_start();
+            break;
+        case 's':
+            scan_arg = optarg;
+            break;
+        case 'D':
+            if (strcmp(optarg, "gen") == 0)
+                cpuinfo_set_decoder(CPUINFO_DECODER_GENERATED);
+            else if (strcmp(optarg, "table") == 0)
+                cpuinfo_set_decoder(CPUINFO_DECODER_TABLE);
+            else
+            {
+                fprintf(stderr, "Unknown decoder %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'B':
+            bench = 1;
+            bench_iters = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+    if (scan_arg)
+    {
+        ret = scan_ram(scan_arg, opts.workers);
+        if (stats)
+            stats_report(stderr, stats == 2);
+        return ret;
+    }
+    if (num_query)
+    {
+        unsigned bad;
+        if (query_compile(&query, query_paths, num_query, &bad) != QUERY_OK)
+        {
+            fprintf(stderr, "Unknown query path %s\n", query_paths[bad]);
+            return -1;
+        }
+        opts.query = &query;
+    }
+    if (symbols_path)
+    {
+        if (symtab_load(&symbols, symbols_path) < 0)
+        {
+            fprintf(stderr, "Cannot read symbols %s\n", symbols_path);
+            return -1;
+        }
+        opts.symbols = &symbols;
+    }
+    if (watch_dir)
+    {
+        if (group || pack_out || optind < argc)
+        {
+            print_usage();
+            return -1;
+        }
+        opts.label = out_dir == NULL;
+        ret = watch_run(&opts, watch_dir, out_dir);
+        if (symbols_path)
+            symtab_free(&symbols);
+        if (stats)
+            stats_report(stderr, stats == 2);
+        return ret;
+    }
+    if (optind >= argc || ((pack_out || map_out_path) && optind != argc - 1) || (columns && (num_query == 0 || group))
+        || (lint && (group || columns)) || (cluster && (group || columns || lint)))
+    {
+        print_usage();
+        return -1;
+    }
+
+    if (bench)
+    {
+        if (optind != argc - 1)
+        {
+            print_usage();
+            return -1;
+        }
+        return bench_decoders(argv[optind], opts.raw_layout, bench_iters);
+    }
+
+    if (map_out_path)
+    {
+        ret = map_out(argv[optind], opts.raw_layout, opts.symbols, map_out_path, opts.workers);
+        if (symbols_path)
+            symtab_free(&symbols);
+        if (stats)
+            stats_report(stderr, stats == 2);
+        return ret;
+    }
+
+    if (pack_out)
+    {
+        // get saved info dumped from cam, typically CPUINFO.DAT,
+        // either raw or in a dump container
+        struct dumpfile_s df;
+        ret = dumpfile_open(argv[optind], opts.raw_layout, &df);
+        if (ret != DUMPFILE_OK)
+        {
+            fprintf(stderr, "%s: %s\n", argv[optind], dumpfile_strerror(ret));
+            return -1;
+        }
+        ret = pack_dump(&df, pack_out, image_args, num_images);
+        dumpfile_close(&df);
+        return ret;
+    }
+
+    // files and/or directories; a single file is decoded just like before, unlabelled
+    struct ingest_list_s list = {};
+    struct stat st;
+    opts.label = optind != argc - 1 || (stat(argv[optind], &st) == 0 && S_ISDIR(st.st_mode));
+    for (; optind < argc; optind++)
+    {
+        if (ingest_list_add(&list, argv[optind]) < 0)
+        {
+            fprintf(stderr, "Cannot list %s\n", argv[optind]);
+            return -1;
+        }
+    }
+    if (group)
+        ret = group_run(&opts, &list, mask_words, num_mask);
+    else if (columns)
+        ret = columns_run(&opts, &list, columns);
+    else if (lint)
+        ret = lint_run(&opts, &list);
+    else if (cluster)
+        ret = cluster_run(&opts, &list);
+    else
+        ret = batch_run(&opts, &list);
+    ingest_list_free(&list);
+    if (symbols_path)
+        symtab_free(&symbols);
+    if (stats)
+        stats_report(stderr, stats == 2);
+    return ret;
+}
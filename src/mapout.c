@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "outbuf.h"
+#include "mmumap.h"
+#include "symtab.h"
+#include "taskpool.h"
+#include "mapout.h"
+#include "stats.h"
+
+/*
+A full map is tens of megabytes of CSV.  Instead of formatting it into
+buffers and writing those, the entry types of each chunk give an upper
+bound of its size (rows times the longest row), the file is preallocated
+to the sum of the bounds and mapped, and every walk task formats its
+rows in place at its chunk's offset.  What is left to do serially is
+closing the gaps between the chunks with memmove and truncating the
+file to what was written.
+*/
+
+#define MAPOUT_CHUNKS (MMUMAP_L1_ENTRIES / MAPOUT_CHUNK)
+
+struct mapout_chunk_s {
+    const struct mmumap_s *m;
+    unsigned first;
+    size_t row_max;
+    size_t off;                 // in the file
+    size_t bound;               // bytes reserved for the chunk at off
+    size_t len;                 // bytes written there
+    char *base;                 // the mapped file
+};
+
+static void size_task(void *arg, unsigned worker) {
+    struct mapout_chunk_s *c = arg;
+    (void)worker;
+    // plus the room outbuf_printf() asks for before it formats
+    c->bound = mmumap_rows(c->m, c->first, MAPOUT_CHUNK) * c->row_max + 256;
+}
+
+static void walk_task(void *arg, unsigned worker) {
+    struct mapout_chunk_s *c = arg;
+    struct outbuf_s ob;
+    (void)worker;
+    STATS_TIMER(t);
+    outbuf_init_fixed(&ob, c->base + c->off, c->bound);
+    mmumap_walk(c->m, c->first, MAPOUT_CHUNK, &ob);
+    c->len = ob.len;
+    STATS_STOP(STAT_WALK, t, ob.len);
+}
+
+// the file gets the map with its csvhead line, as --map prints it
+int mapout_write(const struct mmumap_s *m, const char *path, struct taskpool_s *pool) {
+    struct mapout_chunk_s chunks[MAPOUT_CHUNKS];
+    const char *head = m->syms ? csvhead_symbols : csvhead;
+    size_t row_max = MMUMAP_ROW_MAX, size, pos;
+    char *base;
+    unsigned n;
+    int fd, ret = 0;
+
+    if (m->syms) {
+        // padding commas, the separator, then "name+0xOFFSET"
+        row_max += 16 + m->syms->max_name + 11;
+    }
+    for (n = 0; n < MAPOUT_CHUNKS; n++) {
+        chunks[n].m = m;
+        chunks[n].first = n * MAPOUT_CHUNK;
+        chunks[n].row_max = row_max;
+        taskpool_submit(pool, size_task, &chunks[n]);
+    }
+    taskpool_wait(pool);
+    size = strlen(head);
+    for (n = 0; n < MAPOUT_CHUNKS; n++) {
+        chunks[n].off = size;
+        size += chunks[n].bound;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    // fallocate reserves the blocks up front; file systems without it get a sparse file
+    if (fallocate(fd, 0, 0, size) < 0 && ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    memcpy(base, head, strlen(head));
+    for (n = 0; n < MAPOUT_CHUNKS; n++) {
+        chunks[n].base = base;
+        taskpool_submit(pool, walk_task, &chunks[n]);
+    }
+    taskpool_wait(pool);
+
+    STATS_TIMER(t);
+    pos = strlen(head);
+    for (n = 0; n < MAPOUT_CHUNKS; n++) {
+        memmove(base + pos, base + chunks[n].off, chunks[n].len);
+        pos += chunks[n].len;
+    }
+    if (munmap(base, size) < 0 || ftruncate(fd, pos) < 0) {
+        ret = -1;
+    }
+    STATS_STOP(STAT_WRITE, t, pos);
+    if (close(fd) < 0) {
+        ret = -1;
+    }
+    return ret;
+}
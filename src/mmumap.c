@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpuinfo.h"
+#include "dumpfile.h"
+#include "outbuf.h"
+#include "xlat.h"
+#include "mmumap.h"
+#include "lpae.h"
+#include "symtab.h"
+#include "lint.h"
+#include "stats.h"
+
+/*
+Short-descriptor MMU map, after memmapping_vmsa() in CHDK's cpuinfo.c.
+The camera version read the tables through live pointers; here they come
+from the RAM images of a dump container, and the walk can be done in
+chunks of L1 entries so that big tables can be split across workers.
+Long-descriptor tables are handed to lpae.c, with the same chunking: a
+chunk is always a range of 1 MB VA steps.
+*/
+
+const char *csvhead = "Virt.addr,Table,Type,P bit,NG bit,Domain,Phys.addr,L2 ref,S bit,Privileged/Nonpriv.,Caching,Memtype,XN bit\n";
+#define CSV_COLUMNS 13
+
+const char *csvhead_symbols = "Virt.addr,Table,Type,P bit,NG bit,Domain,Phys.addr,L2 ref,S bit,Privileged/Nonpriv.,Caching,Memtype,XN bit,,Symbol\n";
+
+int mmumap_init_vmsa(struct mmumap_s *m, const struct dumpfile_s *df) {
+    int i_ttbcr = cpuinfo_word_index(df->layout, "TTBCR");
+    int i_ttbr0 = cpuinfo_word_index(df->layout, "TTBR0");
+    int i_ttbr1 = cpuinfo_word_index(df->layout, "TTBR1");
+    int i_sctlr = cpuinfo_word_index(df->layout, "SCTLR");
+    int i_prrr = cpuinfo_word_index(df->layout, "PRRR");
+    int i_nmrr = cpuinfo_word_index(df->layout, "NMRR");
+    int i_dacr = cpuinfo_word_index(df->layout, "DACR");
+    unsigned tt0len;
+
+    if (df->layout != CPUINFO_LAYOUT_VMSA || i_ttbcr < 0 || i_ttbr0 < 0 || i_ttbr1 < 0) {
+        return MMUMAP_ERR_LAYOUT;
+    }
+    m->df = df;
+    m->syms = NULL;
+    m->regs.ttbcr = df->words[i_ttbcr];
+    m->regs.ttbr0 = df->words[i_ttbr0];
+    m->regs.ttbr1 = df->words[i_ttbr1];
+    m->mair[0] = m->mair[1] = 0;
+    // without a DACR every domain is a client, access is what the AP bits say
+    cpuinfo_dacr_init(&m->dacr, i_dacr < 0 ? 0x55555555 : df->words[i_dacr]);
+    m->lpae = (m->regs.ttbcr & 0x80000000) != 0;
+    if (m->lpae) {
+        m->remap.tre = 0;
+        m->mair[0] = i_prrr < 0 ? 0 : df->words[i_prrr];
+        m->mair[1] = i_nmrr < 0 ? 0 : df->words[i_nmrr];
+        return lpae_init(m);
+    }
+    cpuinfo_remap_init(&m->remap, i_sctlr < 0 ? 0 : df->words[i_sctlr],
+                       i_prrr < 0 ? 0 : df->words[i_prrr], i_nmrr < 0 ? 0 : df->words[i_nmrr]);
+    tt0len = 128 << (7 - (m->regs.ttbcr & 7));
+    m->tt0_entries = tt0len / 4;
+    m->tt0adr = m->regs.ttbr0 & 0xffffff80;
+    m->tt1adr = m->regs.ttbr1 & 0xffffff80;
+    m->tt0 = dumpfile_phys(df, m->tt0adr, tt0len);
+    if (m->tt0 == NULL) {
+        return MMUMAP_ERR_TT0;
+    }
+    m->tt1 = NULL;
+    if (tt0len < 0x4000) {
+        m->tt1 = dumpfile_phys(df, m->tt1adr + tt0len, 0x4000 - tt0len);
+        if (m->tt1 == NULL) {
+            return MMUMAP_ERR_TT1;
+        }
+    }
+    return 0;
+}
+
+const char *mmumap_strerror(int err) {
+    switch (err) {
+        case MMUMAP_ERR_LAYOUT: return "not a VMSA dump";
+        case MMUMAP_ERR_TT0: return "TTBR0 table not in any image";
+        case MMUMAP_ERR_TT1: return "TTBR1 table not in any image";
+    }
+    return "unknown error";
+}
+
+// L1 entry n and the table it belongs to: [*tbl, *tbl + *tbl_len) with n at index *idx
+static uint32_t l1_entry(const struct mmumap_s *m, unsigned n, uint32_t *pa,
+                         const uint32_t **tbl, unsigned *idx, unsigned *tbl_len) {
+    if (n < m->tt0_entries) {
+        *pa = m->tt0adr + 4 * n;
+        *tbl = m->tt0;
+        *idx = n;
+        *tbl_len = m->tt0_entries;
+    }
+    else {
+        *pa = m->tt1adr + 4 * n;
+        *tbl = m->tt1;
+        *idx = n - m->tt0_entries;
+        *tbl_len = MMUMAP_L1_ENTRIES - m->tt0_entries;
+    }
+    return (*tbl)[*idx];
+}
+
+static int l1_is_supersection(uint32_t e) {
+    return (e & 3) == 2 && (e & 0x40000);
+}
+
+enum {
+    RUN_OK,
+    RUN_UNALIGNED,
+    RUN_INCONSISTENT,
+};
+
+static const char *super_conclude[] = {
+    "\n", "ERR: Unaligned supersection\n", "ERR: Inconsistent supersection\n"
+};
+static const char *large_conclude[] = {
+    "\n", "ERR: Unaligned large page\n", "ERR: Inconsistent large page\n"
+};
+
+// start of a 16 entry supersection or large page run: must be aligned and repeated
+static unsigned check_run(const uint32_t *tbl, unsigned idx, unsigned tbl_len, uint32_t pa) {
+    unsigned m;
+    if (pa & 0x3f) {
+        return RUN_UNALIGNED;
+    }
+    for (m = 1; m < 16; m++) {
+        if (idx + m >= tbl_len || tbl[idx] != tbl[idx + m]) {
+            return RUN_INCONSISTENT;
+        }
+    }
+    return RUN_OK;
+}
+
+// ends a row with conclude ("\n" or an error), after it the symbol of va if there are symbols
+void mmumap_row_end(const struct mmumap_s *m, uint32_t va, const char *conclude, struct outbuf_s *ob) {
+    size_t n;
+    unsigned commas = 0;
+    if (m->syms == NULL) {
+        outbuf_puts(ob, conclude);
+        return;
+    }
+    // short rows (Fault) are padded so that the symbol is always in the last column
+    for (n = ob->len; n > 0 && ob->data[n - 1] != '\n'; n--) {
+        commas += ob->data[n - 1] == ',';
+    }
+    while (commas++ < CSV_COLUMNS) {
+        outbuf_write(ob, ",", 1);
+    }
+    outbuf_write(ob, conclude, strlen(conclude) - 1);
+    outbuf_write(ob, ",", 1);
+    symtab_annotate(m->syms, va, ob);
+    outbuf_write(ob, "\n", 1);
+}
+
+static void walk_l2(const struct mmumap_s *m, const uint32_t *ee, uint32_t l2pa, uint32_t l2a, struct outbuf_s *ob) {
+    char buf[256];
+    unsigned nn, rr, prr = 42;
+    const char *conclude;
+    for (nn = 0; nn < MMUMAP_L2_ENTRIES; nn++) {
+        outbuf_printf(ob, "0x%08X,L2,", l2a); // virtual address to be described by L2 entry
+        conclude = "\n";
+        STATS_TIMER(t);
+        rr = interpret_l2_table_entry(ee[nn], &m->remap, buf);
+        STATS_STOP(STAT_L2, t, 0);
+        outbuf_puts(ob, buf);
+        if (rr == 1 && prr != 1) { // large page begins
+            conclude = large_conclude[check_run(ee, nn, MMUMAP_L2_ENTRIES, l2pa + 4 * nn)];
+        }
+        mmumap_row_end(m, l2a, conclude, ob);
+        prr = rr;
+        l2a += 0x1000;
+    }
+}
+
+// describes L1 entries [first, first+count) in csvhead format, output is
+// the same whether the table is walked in one go or in chunks
+void mmumap_walk(const struct mmumap_s *m, unsigned first, unsigned count, struct outbuf_s *ob) {
+    const uint32_t *tbl;
+    unsigned n, idx, tbl_len, r, pr = 42;
+    uint32_t pa, e;
+    char buf[256];
+    const char *conclude;
+
+    if (m->lpae) {
+        lpae_walk(m, first << 20, (uint64_t)(first + count) << 20, ob);
+        return;
+    }
+    if (first > 0 && l1_is_supersection(l1_entry(m, first - 1, &pa, &tbl, &idx, &tbl_len))) {
+        pr = 1;
+    }
+    for (n = first; n < first + count && n < MMUMAP_L1_ENTRIES; n++) {
+        uint32_t l1a = n << 20;
+        e = l1_entry(m, n, &pa, &tbl, &idx, &tbl_len);
+        outbuf_printf(ob, "0x%08X,L1,", l1a); // virtual address to be described by L1 entry
+        conclude = "\n";
+        STATS_TIMER(t);
+        r = interpret_l1_table_entry(e, &m->remap, buf);
+        STATS_STOP(STAT_L1, t, 0);
+        outbuf_puts(ob, buf);
+        if (r == 1 && pr != 1) { // supersection begins
+            conclude = super_conclude[check_run(tbl, idx, tbl_len, pa)];
+        }
+        if (r > 42) { // interpret L2 table
+            const uint32_t *ee = dumpfile_phys(m->df, r, MMUMAP_L2_ENTRIES * 4);
+            if (ee == NULL) {
+                mmumap_row_end(m, l1a, "ERR: L2 table not in image\n", ob);
+            }
+            else {
+                mmumap_row_end(m, l1a, conclude, ob);
+                walk_l2(m, ee, r, l1a, ob);
+            }
+        }
+        else {
+            mmumap_row_end(m, l1a, conclude, ob);
+        }
+        pr = r;
+    }
+}
+
+// rows mmumap_walk() writes for the same L1 entries, from the entry types alone
+size_t mmumap_rows(const struct mmumap_s *m, unsigned first, unsigned count) {
+    const uint32_t *tbl;
+    unsigned n, idx, tbl_len;
+    uint32_t pa, e;
+    size_t rows = 0;
+
+    if (m->lpae) {
+        return lpae_rows(m, first << 20, (uint64_t)(first + count) << 20);
+    }
+    for (n = first; n < first + count && n < MMUMAP_L1_ENTRIES; n++) {
+        e = l1_entry(m, n, &pa, &tbl, &idx, &tbl_len);
+        rows++;
+        if ((e & 3) == 1 && (e & 0xfffffc00) > 42
+              && dumpfile_phys(m->df, e & 0xfffffc00, MMUMAP_L2_ENTRIES * 4) != NULL) {
+            rows += MMUMAP_L2_ENTRIES;
+        }
+    }
+    return rows;
+}
+
+/*
+Lint (lint.h table rules) makes one pass over a table to set bitmaps of
+the entries each rule looks at, one bit per entry; the rules then only
+visit the set bits.  Runs of 16 are checked where they start, a set bit
+after a clear one, like the walker does it.
+*/
+
+#define L1_WORDS (MMUMAP_L1_ENTRIES / 32)
+#define L2_WORDS (MMUMAP_L2_ENTRIES / 32)
+
+static uint32_t ap_reserved(unsigned apx_ap) {
+    return apx_ap == 4 || apx_ap == 7;
+}
+
+// first set bit at or after from, words * 32 if none
+static unsigned next_bit(const uint32_t *bits, unsigned words, unsigned from) {
+    unsigned w = from / 32;
+    uint32_t b;
+    if (w >= words) {
+        return words * 32;
+    }
+    for (b = bits[w] & (0xffffffffu << (from % 32)); b == 0; b = bits[w]) {
+        if (++w == words) {
+            return words * 32;
+        }
+    }
+    return w * 32 + __builtin_ctz(b);
+}
+
+static void run_starts(const uint32_t *bits, uint32_t *starts, unsigned words) {
+    uint32_t carry = 0;
+    unsigned w;
+    for (w = 0; w < words; w++) {
+        starts[w] = bits[w] & ~((bits[w] << 1) | carry);
+        carry = bits[w] >> 31;
+    }
+}
+
+// all set bits as one finding count, at the VA of the first
+static void lint_bits(const uint32_t *bits, unsigned words, unsigned rule, uint32_t va,
+                      unsigned shift, struct lint_dump_s *d) {
+    uint64_t n = 0;
+    unsigned w;
+    for (w = 0; w < words; w++) {
+        n += __builtin_popcount(bits[w]);
+    }
+    if (n) {
+        lint_report(d, rule, va + (next_bit(bits, words, 0) << shift), n);
+    }
+}
+
+static void lint_l2(const uint32_t *ee, uint32_t l2pa, uint32_t va, struct lint_dump_s *d) {
+    uint32_t large[L2_WORDS] = {0}, rsrvd[L2_WORDS] = {0}, starts[L2_WORDS];
+    unsigned nn, r;
+    for (nn = 0; nn < MMUMAP_L2_ENTRIES; nn++) {
+        uint32_t e = ee[nn];
+        large[nn / 32] |= (uint32_t)((e & 3) == 1) << (nn % 32);
+        if (e & 3) {
+            rsrvd[nn / 32] |= ap_reserved(((e >> 7) & 4) | ((e >> 4) & 3)) << (nn % 32);
+        }
+    }
+    run_starts(large, starts, L2_WORDS);
+    for (nn = next_bit(starts, L2_WORDS, 0); nn < MMUMAP_L2_ENTRIES; nn = next_bit(starts, L2_WORDS, nn + 1)) {
+        r = check_run(ee, nn, MMUMAP_L2_ENTRIES, l2pa + 4 * nn);
+        if (r != RUN_OK) {
+            lint_report(d, LINT_UNALIGNED_LARGE_PAGE + r - RUN_UNALIGNED, va + (nn << 12), 1);
+        }
+    }
+    lint_bits(rsrvd, L2_WORDS, LINT_RESERVED_AP, va, 12, d);
+}
+
+// adds the findings of the table rules of lint.h to d
+void mmumap_lint(const struct mmumap_s *m, struct lint_dump_s *d) {
+    uint32_t super[L1_WORDS] = {0}, ref[L1_WORDS] = {0}, rsrvd[L1_WORDS] = {0}, starts[L1_WORDS];
+    const uint32_t *tbl, *ee;
+    unsigned n, idx, tbl_len, r;
+    uint32_t pa, e;
+
+    if (m->lpae) {
+        lpae_lint(m, d);
+        return;
+    }
+    for (n = 0; n < MMUMAP_L1_ENTRIES; n++) {
+        e = l1_entry(m, n, &pa, &tbl, &idx, &tbl_len);
+        if ((e & 3) == 2) {
+            super[n / 32] |= ((e >> 18) & 1) << (n % 32);
+            rsrvd[n / 32] |= ap_reserved(((e >> 13) & 4) | ((e >> 10) & 3)) << (n % 32);
+        }
+        ref[n / 32] |= (uint32_t)((e & 3) == 1) << (n % 32);
+    }
+    run_starts(super, starts, L1_WORDS);
+    for (n = next_bit(starts, L1_WORDS, 0); n < MMUMAP_L1_ENTRIES; n = next_bit(starts, L1_WORDS, n + 1)) {
+        l1_entry(m, n, &pa, &tbl, &idx, &tbl_len);
+        r = check_run(tbl, idx, tbl_len, pa);
+        if (r != RUN_OK) {
+            lint_report(d, LINT_UNALIGNED_SUPERSECTION + r - RUN_UNALIGNED, n << 20, 1);
+        }
+    }
+    lint_bits(rsrvd, L1_WORDS, LINT_RESERVED_AP, 0, 20, d);
+    for (n = next_bit(ref, L1_WORDS, 0); n < MMUMAP_L1_ENTRIES; n = next_bit(ref, L1_WORDS, n + 1)) {
+        e = l1_entry(m, n, &pa, &tbl, &idx, &tbl_len);
+        ee = dumpfile_phys(m->df, e & 0xfffffc00, MMUMAP_L2_ENTRIES * 4);
+        if (ee == NULL) {
+            lint_report(d, LINT_TABLE_NOT_IN_IMAGE, n << 20, 1);
+        }
+        else {
+            lint_l2(ee, e & 0xfffffc00, n << 20, d);
+        }
+    }
+}
+
+static void section_attr(uint32_t e, struct xlat_attr_s *a) {
+    memset(a, 0, sizeof(*a));
+    a->format = XLAT_SHORT;
+    a->ap = ((e >> 13) & 4) | ((e >> 10) & 3);
+    a->xn = (e >> 4) & 1;
+    a->domain = (e >> 5) & 15;
+    a->memattr = ((e >> 10) & 0x1c) | ((e >> 2) & 3);
+    a->shareable = (e >> 16) & 1;
+    a->ng = (e >> 17) & 1;
+    a->ns = (e >> 19) & 1;
+}
+
+// small and large page attributes; domain and NS come from the L1 entry
+static void page_attr(uint32_t e, uint32_t l1, struct xlat_attr_s *a) {
+    memset(a, 0, sizeof(*a));
+    a->format = XLAT_SHORT;
+    a->ap = ((e >> 7) & 4) | ((e >> 4) & 3);
+    if (e & 2) {
+        a->xn = e & 1;
+        a->memattr = ((e >> 4) & 0x1c) | ((e >> 2) & 3);
+    }
+    else {
+        a->xn = (e >> 15) & 1;
+        a->memattr = ((e >> 10) & 0x1c) | ((e >> 2) & 3);
+    }
+    a->domain = (l1 >> 5) & 15;
+    a->shareable = (e >> 10) & 1;
+    a->ng = (e >> 11) & 1;
+    a->ns = (l1 >> 3) & 1;
+}
+
+static void index_l2(const uint32_t *ee, uint32_t l1, uint32_t va, struct xlat_s *x) {
+    struct xlat_attr_s a;
+    unsigned nn = 0, run;
+    while (nn < MMUMAP_L2_ENTRIES) {
+        uint32_t e = ee[nn];
+        switch (e & 3) {
+            case 0:
+                nn++;
+                break;
+            case 1: // large page, 16 identical entries for 64 KB
+                page_attr(e, l1, &a);
+                xlat_add(x, va + (nn << 12), (e & 0xffff0000) + ((nn & 15) << 12), 0x1000, &a);
+                nn++;
+                break;
+            default:
+                page_attr(e, l1, &a);
+                run = xlat_run32(ee + nn, MMUMAP_L2_ENTRIES - nn, 0x1000);
+                xlat_add(x, va + (nn << 12), e & 0xfffff000, run << 12, &a);
+                nn += run;
+        }
+    }
+}
+
+// adds the mappings of L1 entries [first, first+count) to x; chunk indexes
+// added in order with xlat_append() give the same index as one big walk
+void mmumap_index(const struct mmumap_s *m, unsigned first, unsigned count, struct xlat_s *x) {
+    const uint32_t *tbl;
+    unsigned n, idx, tbl_len, run, end = first + count;
+    uint32_t pa, e;
+    struct xlat_attr_s a;
+
+    x->mair[0] = m->mair[0];
+    x->mair[1] = m->mair[1];
+    x->remap = m->remap;
+    x->dacr = m->dacr;
+    if (m->lpae) {
+        lpae_index(m, first << 20, (uint64_t)end << 20, x);
+        return;
+    }
+    if (end > MMUMAP_L1_ENTRIES) {
+        end = MMUMAP_L1_ENTRIES;
+    }
+    for (n = first; n < end; ) {
+        e = l1_entry(m, n, &pa, &tbl, &idx, &tbl_len);
+        run = 1;
+        if (l1_is_supersection(e)) {
+            uint64_t spa = (e & 0xff000000) | ((uint64_t)(e & 0xf00000) << 12) | ((uint64_t)(e & 0x1e0) << 31);
+            section_attr(e, &a);
+            a.domain = 0; // supersections are always domain 0, bits 8..5 extend the PA
+            xlat_add(x, n << 20, spa + ((n & 15) << 20), 0x100000, &a);
+        }
+        else if ((e & 3) == 2) {
+            if (tbl_len - idx < end - n) {
+                run = xlat_run32(tbl + idx, tbl_len - idx, 0x100000);
+            }
+            else {
+                run = xlat_run32(tbl + idx, end - n, 0x100000);
+            }
+            section_attr(e, &a);
+            xlat_add(x, n << 20, e & 0xfff00000, (uint64_t)run << 20, &a);
+        }
+        else if ((e & 3) == 1) {
+            const uint32_t *ee = dumpfile_phys(m->df, e & 0xfffffc00, MMUMAP_L2_ENTRIES * 4);
+            if (ee != NULL) {
+                index_l2(ee, e, n << 20, x);
+            }
+        }
+        n += run;
+    }
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "arena.h"
+#include "outbuf.h"
+
+void outbuf_init(struct outbuf_s *ob) {
+    ob->data = NULL;
+    ob->len = 0;
+    ob->cap = 0;
+    ob->arena = NULL;
+    ob->fixed = 0;
+}
+
+// an empty buffer whose memory comes from arena and goes with its next reset
+void outbuf_init_arena(struct outbuf_s *ob, struct arena_s *arena) {
+    outbuf_init(ob);
+    ob->arena = arena;
+}
+
+// writes into [data, data + cap), sized up front by the caller; overflowing it is a bug
+void outbuf_init_fixed(struct outbuf_s *ob, char *data, size_t cap) {
+    outbuf_init(ob);
+    ob->data = data;
+    ob->cap = cap;
+    ob->fixed = 1;
+}
+
+void outbuf_free(struct outbuf_s *ob) {
+    if (ob->arena == NULL && !ob->fixed) {
+        free(ob->data);
+    }
+    outbuf_init(ob);
+}
+
+void outbuf_reset(struct outbuf_s *ob) {
+    ob->len = 0;
+}
+
+// returns room for n more bytes at the end of the buffer, the caller advances len
+char *outbuf_reserve(struct outbuf_s *ob, size_t n) {
+    if (ob->len + n > ob->cap) {
+        if (ob->fixed) {
+            fprintf(stderr, "Output buffer overflow\n");
+            exit(-1);
+        }
+        size_t cap = ob->cap ? ob->cap : 4096;
+        while (cap < ob->len + n) {
+            cap *= 2;
+        }
+        char *p = ob->arena ? arena_grow(ob->arena, ob->data, ob->cap, cap) : realloc(ob->data, cap);
+        if (p == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        ob->data = p;
+        ob->cap = cap;
+    }
+    return ob->data + ob->len;
+}
+
+void outbuf_write(struct outbuf_s *ob, const void *data, size_t n) {
+    memcpy(outbuf_reserve(ob, n), data, n);
+    ob->len += n;
+}
+
+void outbuf_puts(struct outbuf_s *ob, const char *s) {
+    outbuf_write(ob, s, strlen(s));
+}
+
+// a CSV cell, quoted when the text has commas or quotes of its own
+void outbuf_csv_cell(struct outbuf_s *ob, const char *s) {
+    if (strpbrk(s, ",\"\n") == NULL) {
+        outbuf_puts(ob, s);
+        return;
+    }
+    outbuf_puts(ob, "\"");
+    for (; *s; s++) {
+        if (*s == '"') {
+            outbuf_puts(ob, "\"");
+        }
+        outbuf_write(ob, s, 1);
+    }
+    outbuf_puts(ob, "\"");
+}
+
+void outbuf_printf(struct outbuf_s *ob, const char *fmt, ...) {
+    va_list ap;
+    int n;
+    char *p = outbuf_reserve(ob, 256);
+    va_start(ap, fmt);
+    n = vsnprintf(p, ob->cap - ob->len, fmt, ap);
+    va_end(ap);
+    if ((size_t)n >= ob->cap - ob->len) {
+        p = outbuf_reserve(ob, n + 1);
+        va_start(ap, fmt);
+        vsnprintf(p, n + 1, fmt, ap);
+        va_end(ap);
+    }
+    ob->len += n;
+}
+
+int outbuf_flush(struct outbuf_s *ob, FILE *f) {
+    int ret = 0;
+    if (ob->len && fwrite(ob->data, 1, ob->len, f) != ob->len) {
+        ret = -1;
+    }
+    ob->len = 0;
+    return ret;
+}
+
+#define FLUSHV_IOV 64
+
+// writes n buffers in order straight to f's file descriptor, FLUSHV_IOV per writev
+int outbuf_flushv(struct outbuf_s *const *bufs, unsigned n, FILE *f) {
+    struct iovec iov[FLUSHV_IOV];
+    unsigned i = 0, num = 0, first = 0;
+    int ret = 0;
+
+    if (fflush(f) != 0) {
+        ret = -1;
+    }
+    while (ret == 0 && (i < n || num > 0)) {
+        ssize_t done;
+        // gather up to FLUSHV_IOV non-empty buffers
+        while (i < n && num < FLUSHV_IOV) {
+            if (bufs[i]->len) {
+                iov[num].iov_base = bufs[i]->data;
+                iov[num].iov_len = bufs[i]->len;
+                num++;
+            }
+            i++;
+        }
+        if (num == 0) {
+            break;
+        }
+        done = writev(fileno(f), iov + first, num - first);
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ret = -1;
+            break;
+        }
+        // skip what was written, the rest goes out with the next writev
+        while (first < num && (size_t)done >= iov[first].iov_len) {
+            done -= iov[first].iov_len;
+            first++;
+        }
+        if (first < num) {
+            iov[first].iov_base = (char *)iov[first].iov_base + done;
+            iov[first].iov_len -= done;
+        }
+        else {
+            first = num = 0;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        bufs[i]->len = 0;
+    }
+    return ret;
+}
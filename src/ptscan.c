@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "taskpool.h"
+#include "ptscan.h"
+
+/*
+Every 16 KB aligned offset of the image is scored as a candidate L1
+table, with the descriptor rules of interpret_l1_table_entry():
+
+- type 0 is a fault, neutral; type 3 is reserved
+- type 1 is an L2 ref, its table should be inside the image and bit 4 is SBZ
+- type 2 is a section, or a supersection with bit 18, which must come in
+  aligned runs of 16 identical entries; APX=1 with AP=00 or 11 is reserved
+
+Counting is done 8 entries at a time with GCC vector extensions, cloned
+for AVX2 where the compiler can, and the image is split across the task
+pool in chunks of candidates.
+*/
+
+#define TABLE_SIZE      0x4000
+#define TABLE_ENTRIES   (TABLE_SIZE / 4)
+#define TASK_TABLES     1024        // candidates per task, 16 MB of image
+#define MIN_VALID       16          // fewer mapped entries than this is not a table
+
+#if defined(__i386__) || defined(__x86_64__)
+#define SCAN_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define SCAN_CLONES
+#endif
+
+typedef uint32_t v8u __attribute__((vector_size(32)));
+
+struct scan_counts_s {
+    unsigned sec, super, l2in, l2out, invalid;
+};
+
+struct scan_s {
+    uint64_t base;
+    const uint8_t *data;
+    uint64_t size;
+    uint32_t l2_limit;      // an L2 table at base + x is inside if x <= l2_limit
+};
+
+struct scan_task_s {
+    const struct scan_s *s;
+    uint64_t first, last;   // candidate offsets [first, last)
+    struct ptscan_hit_s hits[PTSCAN_MAX_HITS];
+    unsigned num_hits;
+};
+
+SCAN_CLONES
+static void count_entries(const uint32_t *tbl, uint32_t img_base, uint32_t l2_limit,
+                          struct scan_counts_s *c) {
+    v8u sec = {}, super = {}, l2in = {}, l2out = {}, invalid = {};
+    unsigned n, k;
+    for (n = 0; n < TABLE_ENTRIES; n += 8) {
+        v8u e, t, is_l2, is_sec, inside, ap;
+        memcpy(&e, tbl + n, sizeof(e));
+        t = e & 3;
+        is_l2 = (v8u)(t == 1);
+        is_sec = (v8u)(t == 2);
+        inside = (v8u)(((e & 0xfffffc00) - img_base) <= l2_limit);
+        ap = e & 0x8C00;
+        sec -= is_sec;
+        super -= is_sec & (v8u)((e & 0x40000) != 0);
+        l2in -= is_l2 & inside;
+        l2out -= is_l2 & ~inside;
+        invalid -= (v8u)(t == 3);
+        invalid -= is_l2 & (v8u)((e & 0x10) != 0);
+        invalid -= is_sec & ((v8u)(ap == 0x8000) | (v8u)(ap == 0x8C00));
+    }
+    memset(c, 0, sizeof(*c));
+    for (k = 0; k < 8; k++) {
+        c->sec += sec[k];
+        c->super += super[k];
+        c->l2in += l2in[k];
+        c->l2out += l2out[k];
+        c->invalid += invalid[k];
+    }
+}
+
+// supersections are rare, check their runs with plain code
+static unsigned broken_supersections(const uint32_t *tbl) {
+    unsigned n, m, broken = 0;
+    for (n = 0; n < TABLE_ENTRIES; n += 16) {
+        int any = 0, same = 1;
+        for (m = 0; m < 16; m++) {
+            uint32_t e = tbl[n + m];
+            any |= (e & 3) == 2 && (e & 0x40000);
+            same &= e == tbl[n];
+        }
+        broken += any && !same;
+    }
+    return broken;
+}
+
+static int hit_before(const struct ptscan_hit_s *a, const struct ptscan_hit_s *b) {
+    return a->score > b->score || (a->score == b->score && a->pa < b->pa);
+}
+
+// keeps the best max hits, best first
+static void add_hit(struct ptscan_hit_s *hits, unsigned *num, unsigned max, const struct ptscan_hit_s *h) {
+    unsigned n = *num;
+    if (n == max) {
+        if (!hit_before(h, &hits[n - 1])) {
+            return;
+        }
+        n--;
+    }
+    while (n > 0 && hit_before(h, &hits[n - 1])) {
+        hits[n] = hits[n - 1];
+        n--;
+    }
+    hits[n] = *h;
+    if (*num < max) {
+        (*num)++;
+    }
+}
+
+static void scan_task(void *arg, unsigned worker) {
+    struct scan_task_s *t = arg;
+    const struct scan_s *s = t->s;
+    uint64_t off;
+    (void)worker;
+
+    for (off = t->first; off < t->last; off += TABLE_SIZE) {
+        const uint32_t *tbl = (const uint32_t *)(s->data + off);
+        struct scan_counts_s c;
+        struct ptscan_hit_s h;
+
+        count_entries(tbl, s->base, s->l2_limit, &c);
+        if (c.sec + c.l2in < MIN_VALID) {
+            continue;
+        }
+        if (c.super) {
+            c.invalid += 16 * broken_supersections(tbl);
+        }
+        h.pa = s->base + off;
+        h.score = (int)(c.sec + c.l2in) - 2 * (int)c.l2out - 4 * (int)c.invalid;
+        if (h.score <= 0) {
+            continue;
+        }
+        h.sections = c.sec - c.super;
+        h.supersections = c.super;
+        h.l2_inside = c.l2in;
+        h.l2_outside = c.l2out;
+        h.invalid = c.invalid;
+        add_hit(t->hits, &t->num_hits, PTSCAN_MAX_HITS, &h);
+    }
+}
+
+// returns the number of candidates stored in hits, best first
+unsigned ptscan_image(struct taskpool_s *pool, uint64_t base, const void *data, uint64_t size,
+                      struct ptscan_hit_s *hits, unsigned max_hits) {
+    struct scan_s s;
+    struct scan_task_s *tasks;
+    uint64_t first, num_tables;
+    unsigned n, k, num_tasks, num_hits = 0;
+
+    // short descriptors only reach the first 4 GB, and tables are 16 KB aligned
+    first = (TABLE_SIZE - (base & (TABLE_SIZE - 1))) & (TABLE_SIZE - 1);
+    if (base + first >= 0x100000000ULL || size < first + TABLE_SIZE || max_hits == 0) {
+        return 0;
+    }
+    if (max_hits > PTSCAN_MAX_HITS) {
+        max_hits = PTSCAN_MAX_HITS;
+    }
+    s.base = base;
+    s.data = data;
+    s.size = size;
+    s.l2_limit = (base + size > 0x100000000ULL ? 0x100000000ULL - base : size) - 1024;
+    num_tables = (size - first) / TABLE_SIZE;
+    if (num_tables > (0x100000000ULL - base - first) / TABLE_SIZE) {
+        num_tables = (0x100000000ULL - base - first) / TABLE_SIZE; // a TTBR can't point past 4 GB
+    }
+    num_tasks = (num_tables + TASK_TABLES - 1) / TASK_TABLES;
+
+    tasks = calloc(num_tasks, sizeof(*tasks));
+    if (tasks == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 0;
+    }
+    for (n = 0; n < num_tasks; n++) {
+        tasks[n].s = &s;
+        tasks[n].first = first + (uint64_t)n * TASK_TABLES * TABLE_SIZE;
+        tasks[n].last = tasks[n].first + (uint64_t)TASK_TABLES * TABLE_SIZE;
+        if (tasks[n].last > first + num_tables * TABLE_SIZE) {
+            tasks[n].last = first + num_tables * TABLE_SIZE;
+        }
+        taskpool_submit(pool, scan_task, &tasks[n]);
+    }
+    taskpool_wait(pool);
+
+    for (n = 0; n < num_tasks; n++) {
+        for (k = 0; k < tasks[n].num_hits; k++) {
+            add_hit(hits, &num_hits, max_hits, &tasks[n].hits[k]);
+        }
+    }
+    free(tasks);
+    return num_hits;
+}
+
+void ptscan_print(FILE *f, const struct ptscan_hit_s *hits, unsigned num_hits) {
+    unsigned n;
+    fprintf(f, "Table addr,Score,Sections,Supersections,L2 refs,L2 refs outside,Invalid\n");
+    for (n = 0; n < num_hits; n++) {
+        fprintf(f, "0x%08llX,%d,%u,%u,%u,%u,%u\n", (unsigned long long)hits[n].pa, hits[n].score,
+                hits[n].sections, hits[n].supersections, hits[n].l2_inside,
+                hits[n].l2_outside, hits[n].invalid);
+    }
+}
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuinfo.h"
+#include "outbuf.h"
+#include "json.h"
+#include "query.h"
+#include "stats.h"
+
+/*
+Query paths are "Word.Field" with the names of the descriptor tables, or
+just "Word" for the raw register.  Names contain dots and commas of their
+own ("Cache size ID reg (data, level0)", "Virt. extensions"), so a path
+is never split: every word and word.field name of a layout is hashed
+whole into an open addressing table, and a path is looked up as is.
+This happens once, before any dump is read; per dump only the resolved
+shift/width pairs are applied.
+*/
+
+struct name_slot_s {
+    uint32_t hash;
+    int word;           // -1: empty slot
+    int field;          // -1: the word itself
+};
+
+struct name_index_s {
+    const struct cpuinfo_word_desc_s *desc;
+    unsigned mask;
+    struct name_slot_s *slots;
+};
+
+#define FNV_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+static uint32_t fnv1a(uint32_t h, const char *s) {
+    for (; *s; s++) {
+        h = (h ^ (uint8_t)*s) * FNV_PRIME;
+    }
+    return h;
+}
+
+static uint32_t slot_hash(const struct cpuinfo_word_desc_s *desc, int word, int field) {
+    uint32_t h = fnv1a(FNV_BASIS, desc[word].name);
+    if (field >= 0) {
+        h = fnv1a(h, ".");
+        h = fnv1a(h, desc[word].fields[field].name);
+    }
+    return h;
+}
+
+static int slot_matches(const struct cpuinfo_word_desc_s *desc, const struct name_slot_s *s, const char *path) {
+    size_t len = strlen(desc[s->word].name);
+    if (strncmp(path, desc[s->word].name, len) != 0) {
+        return 0;
+    }
+    if (s->field < 0) {
+        return path[len] == 0;
+    }
+    return path[len] == '.' && strcmp(path + len + 1, desc[s->word].fields[s->field].name) == 0;
+}
+
+// a name that is in the table twice keeps its first slot
+static void index_add(struct name_index_s *ix, int word, int field) {
+    uint32_t h = slot_hash(ix->desc, word, field);
+    unsigned n;
+    for (n = h & ix->mask; ix->slots[n].word >= 0; n = (n + 1) & ix->mask) {
+        struct name_slot_s *s = &ix->slots[n];
+        if (s->hash == h && (s->field < 0) == (field < 0)
+              && strcmp(ix->desc[s->word].name, ix->desc[word].name) == 0
+              && (field < 0 || strcmp(ix->desc[s->word].fields[s->field].name,
+                                      ix->desc[word].fields[field].name) == 0)) {
+            return;
+        }
+    }
+    ix->slots[n].hash = h;
+    ix->slots[n].word = word;
+    ix->slots[n].field = field;
+}
+
+static void index_build(struct name_index_s *ix, const struct cpuinfo_word_desc_s *desc) {
+    unsigned num = 0, size = 16, n;
+    int i, j;
+    for (i = 0; desc[i].name; i++) {
+        for (j = 0; desc[i].fields[j].name; j++) {
+            num++;
+        }
+        num++;
+    }
+    while (size < 2 * num) {
+        size *= 2;
+    }
+    ix->desc = desc;
+    ix->mask = size - 1;
+    ix->slots = malloc(size * sizeof(struct name_slot_s));
+    if (ix->slots == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    for (n = 0; n < size; n++) {
+        ix->slots[n].word = -1;
+    }
+    for (i = 0; desc[i].name; i++) {
+        index_add(ix, i, -1);
+        for (j = 0; desc[i].fields[j].name; j++) {
+            index_add(ix, i, j);
+        }
+    }
+}
+
+static const struct name_slot_s *index_find(const struct name_index_s *ix, const char *path) {
+    uint32_t h = fnv1a(FNV_BASIS, path);
+    unsigned n;
+    for (n = h & ix->mask; ix->slots[n].word >= 0; n = (n + 1) & ix->mask) {
+        if (ix->slots[n].hash == h && slot_matches(ix->desc, &ix->slots[n], path)) {
+            return &ix->slots[n];
+        }
+    }
+    return NULL;
+}
+
+static void resolve(const struct name_index_s *ix, const char *path, struct query_field_s *qf) {
+    const struct name_slot_s *s = index_find(ix, path);
+    int j;
+    qf->word = -1;
+    if (s == NULL) {
+        return;
+    }
+    qf->word = s->word;
+    qf->shift = 0;
+    qf->bits = 32;
+    qf->field = NULL;
+    if (s->field >= 0) {
+        for (j = 0; j < s->field; j++) {
+            qf->shift += ix->desc[s->word].fields[j].bits;
+        }
+        qf->field = &ix->desc[s->word].fields[s->field];
+        qf->bits = qf->field->bits;
+    }
+}
+
+// on QUERY_ERR_UNKNOWN, *bad is the index of the first path no layout knows
+int query_compile(struct query_s *q, const char *const *paths, unsigned num, unsigned *bad) {
+    struct name_index_s ix[CPUINFO_LAYOUT_V5 + 1];
+    unsigned layout, n;
+    int ret = QUERY_OK;
+
+    if (num > QUERY_MAX_PATHS) {
+        return QUERY_ERR_TOO_MANY;
+    }
+    q->num = num;
+    for (layout = 0; layout <= CPUINFO_LAYOUT_V5; layout++) {
+        ix[layout].slots = NULL;
+        if (cpuinfo_get_desc(layout) != NULL) {
+            index_build(&ix[layout], cpuinfo_get_desc(layout));
+        }
+    }
+    for (n = 0; n < num; n++) {
+        int found = 0;
+        q->paths[n] = paths[n];
+        for (layout = 0; layout <= CPUINFO_LAYOUT_V5; layout++) {
+            q->fields[layout][n].word = -1;
+            if (ix[layout].slots != NULL) {
+                resolve(&ix[layout], paths[n], &q->fields[layout][n]);
+                found |= q->fields[layout][n].word >= 0;
+            }
+        }
+        if (!found && ret == QUERY_OK) {
+            *bad = n;
+            ret = QUERY_ERR_UNKNOWN;
+        }
+    }
+    for (layout = 0; layout <= CPUINFO_LAYOUT_V5; layout++) {
+        free(ix[layout].slots);
+    }
+    return ret;
+}
+
+static unsigned field_value(const struct query_field_s *qf, const uint32_t *words) {
+    unsigned val = words[qf->word] >> qf->shift;
+    if (qf->bits < 32) {
+        val &= ~(0xFFFFFFFF << qf->bits);
+    }
+    return val;
+}
+
+// "path 0xval val [desc]\n" per path, "path -\n" if the dump's layout hasn't got it
+int query_format(const struct query_s *q, struct outbuf_s *ob, const uint32_t *words, unsigned layout) {
+    unsigned n, val;
+    STATS_TIMER(t_decode);
+    size_t start_len = ob->len;
+
+    if (cpuinfo_get_desc(layout) == NULL) {
+        return -1;
+    }
+    for (n = 0; n < q->num; n++) {
+        const struct query_field_s *qf = &q->fields[layout][n];
+        if (qf->word < 0) {
+            outbuf_printf(ob, "%s -\n", q->paths[n]);
+            continue;
+        }
+        val = field_value(qf, words);
+        if (qf->field == NULL) {
+            outbuf_printf(ob, "%s 0x%08X\n", q->paths[n], val);
+        }
+        else if (qf->field->desc_fn) {
+            outbuf_printf(ob, "%s 0x%X %d [%s]\n", q->paths[n], val, val, qf->field->desc_fn(val));
+        }
+        else {
+            outbuf_printf(ob, "%s 0x%X %d\n", q->paths[n], val, val);
+        }
+    }
+    STATS_STOP(STAT_DECODE, t_decode, ob->len - start_len);
+    return 0;
+}
+
+// a "query" object of the current JSON object, keyed by path; missing paths are null
+int query_format_json(const struct query_s *q, struct json_s *j, const uint32_t *words, unsigned layout) {
+    unsigned n, val;
+    STATS_TIMER(t_decode);
+    size_t start_len = j->ob->len;
+
+    if (cpuinfo_get_desc(layout) == NULL) {
+        return -1;
+    }
+    json_object(j, "query");
+    for (n = 0; n < q->num; n++) {
+        const struct query_field_s *qf = &q->fields[layout][n];
+        if (qf->word < 0) {
+            json_null(j, q->paths[n]);
+            continue;
+        }
+        val = field_value(qf, words);
+        json_object(j, q->paths[n]);
+        json_uint(j, "value", val);
+        if (qf->field && qf->field->desc_fn) {
+            json_string(j, "desc", qf->field->desc_fn(val));
+        }
+        json_object_end(j);
+    }
+    json_object_end(j);
+    STATS_STOP(STAT_DECODE, t_decode, j->ob->len - start_len);
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+static const char *stage_names[STAT_NUM] = {
+    "read", "decode", "desc_fn", "l1_entry", "l2_entry", "walk", "write", "arena", "lint",
+};
+
+#ifdef CPUINFO_STATS
+
+int stats_on;
+__thread struct stats_s *stats_self;
+
+static struct stats_s *stats_list;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// first use on a thread: the block outlives the thread, so the report sees it
+struct stats_s *stats_register(void) {
+    struct stats_s *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    pthread_mutex_lock(&stats_lock);
+    s->next = stats_list;
+    stats_list = s;
+    pthread_mutex_unlock(&stats_lock);
+    stats_self = s;
+    return s;
+}
+
+int stats_enabled(void) {
+    return 1;
+}
+
+// before any worker starts, so the threads see the flag without a barrier
+void stats_start(void) {
+    stats_on = 1;
+}
+
+void stats_report(FILE *f, int json) {
+    struct stats_s total = {};
+    struct stats_s *s;
+    unsigned n, threads = 0;
+
+    pthread_mutex_lock(&stats_lock);
+    for (s = stats_list; s; s = s->next) {
+        for (n = 0; n < STAT_NUM; n++) {
+            total.count[n] += s->count[n];
+            total.bytes[n] += s->bytes[n];
+            total.ticks[n] += s->ticks[n];
+            if (s->peak[n] > total.peak[n]) {
+                total.peak[n] = s->peak[n];
+            }
+        }
+        threads++;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    if (json) {
+        fprintf(f, "{\"unit\":\"%s\",\"threads\":%u,\"stages\":{", STATS_UNIT, threads);
+        for (n = 0; n < STAT_NUM; n++) {
+            fprintf(f, "%s\"%s\":{\"count\":%llu,\"bytes\":%llu,\"ticks\":%llu,\"peak\":%llu}", n ? "," : "",
+                    stage_names[n], (unsigned long long)total.count[n],
+                    (unsigned long long)total.bytes[n], (unsigned long long)total.ticks[n],
+                    (unsigned long long)total.peak[n]);
+        }
+        fprintf(f, "}}\n");
+        return;
+    }
+    fprintf(f, "%-10s %12s %14s %16s %12s %14s\n", "stage", "count", "bytes", STATS_UNIT, "per op", "peak");
+    for (n = 0; n < STAT_NUM; n++) {
+        fprintf(f, "%-10s %12llu %14llu %16llu %12llu %14llu\n", stage_names[n],
+                (unsigned long long)total.count[n], (unsigned long long)total.bytes[n],
+                (unsigned long long)total.ticks[n],
+                (unsigned long long)(total.count[n] ? total.ticks[n] / total.count[n] : 0),
+                (unsigned long long)total.peak[n]);
+    }
+    fprintf(f, "(%u threads)\n", threads);
+}
+
+#else
+
+int stats_enabled(void) {
+    return 0;
+}
+
+void stats_start(void) {
+}
+
+void stats_report(FILE *f, int json) {
+    (void)json;
+    (void)stage_names;
+    fprintf(f, "statistics not compiled in, rebuild with STATS=1\n");
+}
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "outbuf.h"
+#include "symtab.h"
+
+/*
+Symbols are kept sorted by address, and the addresses are copied once
+more in Eytzinger order: the implicit binary tree of a binary search,
+stored breadth first, so the first levels of every lookup share a few
+cache lines and the rest is a straight run down the array.  With
+hundreds of thousands of symbols that keeps a lookup per map row cheap.
+
+Sections and sized symbols nest; a lookup that lands past the end of a
+sized symbol falls back to the innermost sized symbol around it.
+*/
+
+#define MAX_LINE 4096
+
+static int parse_hex(const char *s, uint32_t *val) {
+    char *end;
+    unsigned long long v;
+    if (!isxdigit((unsigned char)*s)) {
+        return 0;
+    }
+    v = strtoull(s, &end, 16);
+    if (*end != 0) {
+        return 0;
+    }
+    *val = v;
+    return 1;
+}
+
+static char *skip_space(char *p) {
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    return p;
+}
+
+static char *skip_token(char *p) {
+    while (*p && !isspace((unsigned char)*p)) {
+        p++;
+    }
+    return p;
+}
+
+// "ADDR [SIZE] [TYPE] NAME"; a single letter before the name is an nm type
+static int parse_line(char *line, uint32_t *addr, uint32_t *size, char **name) {
+    char *p = skip_space(line), *end;
+    int field;
+
+    if (*p == '#') {
+        return 0;
+    }
+    end = skip_token(p);
+    if (*end == 0) {
+        return 0;
+    }
+    *end = 0;
+    if (!parse_hex(p, addr)) {
+        return 0;
+    }
+    *size = 0;
+    p = skip_space(end + 1);
+    for (field = 0; field < 2; field++) {
+        char save, *next;
+        end = skip_token(p);
+        next = skip_space(end);
+        if (*next == 0) {
+            break;                  // last token, the name
+        }
+        if (end - p == 1 && isalpha((unsigned char)*p)) {
+            p = next;               // nm type, the name follows
+            break;
+        }
+        save = *end;
+        *end = 0;
+        if (field > 0 || !parse_hex(p, size)) {
+            *end = save;
+            break;
+        }
+        p = next;
+    }
+    // the rest of the line is the name, C++ names can have spaces
+    *name = p;
+    end = p + strlen(p);
+    while (end > p && isspace((unsigned char)end[-1])) {
+        *--end = 0;
+    }
+    return *p != 0;
+}
+
+static int sym_cmp(const void *a, const void *b) {
+    const struct symtab_sym_s *x = a, *y = b;
+    if (x->addr != y->addr) {
+        return x->addr < y->addr ? -1 : 1;
+    }
+    return x->name < y->name ? -1 : x->name > y->name; // file order
+}
+
+static unsigned eytz_fill(struct symtab_s *st, unsigned i, unsigned k) {
+    if (k <= st->num) {
+        i = eytz_fill(st, i, 2 * k);
+        st->eytz[k] = st->syms[i].addr;
+        st->eytz_pos[k] = i++;
+        i = eytz_fill(st, i, 2 * k + 1);
+    }
+    return i;
+}
+
+static int covers(const struct symtab_sym_s *sym, uint32_t addr) {
+    return sym->size == 0 || addr - sym->addr < sym->size;
+}
+
+static void link_parents(struct symtab_s *st) {
+    uint32_t *stack = malloc((st->num + 1) * sizeof(uint32_t));
+    unsigned n, depth = 0;
+    if (stack == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    for (n = 0; n < st->num; n++) {
+        struct symtab_sym_s *sym = &st->syms[n];
+        while (depth > 0 && !covers(&st->syms[stack[depth - 1]], sym->addr)) {
+            depth--;
+        }
+        sym->parent = depth > 0 ? stack[depth - 1] : SYMTAB_NONE;
+        if (sym->size) {
+            stack[depth++] = n;
+        }
+    }
+    free(stack);
+}
+
+int symtab_load(struct symtab_s *st, const char *path) {
+    char *line, *name;
+    uint32_t addr, size;
+    unsigned cap = 0;
+    FILE *f = fopen(path, "r");
+
+    memset(st, 0, sizeof(*st));
+    outbuf_init(&st->names);
+    if (f == NULL) {
+        return -1;
+    }
+    line = malloc(MAX_LINE);
+    if (line == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    while (fgets(line, MAX_LINE, f)) {
+        struct symtab_sym_s *sym;
+        if (!parse_line(line, &addr, &size, &name)) {
+            continue;
+        }
+        if (st->num == cap) {
+            cap = cap ? 2 * cap : 1024;
+            sym = realloc(st->syms, cap * sizeof(*sym));
+            if (sym == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(-1);
+            }
+            st->syms = sym;
+        }
+        sym = &st->syms[st->num++];
+        sym->addr = addr;
+        sym->size = size;
+        sym->name = st->names.len;
+        if (strlen(name) > st->max_name) {
+            st->max_name = strlen(name);
+        }
+        outbuf_write(&st->names, name, strlen(name) + 1);
+    }
+    free(line);
+    fclose(f);
+
+    qsort(st->syms, st->num, sizeof(*st->syms), sym_cmp);
+    link_parents(st);
+    st->eytz = malloc((st->num + 1) * sizeof(uint32_t));
+    st->eytz_pos = malloc((st->num + 1) * sizeof(uint32_t));
+    if (st->eytz == NULL || st->eytz_pos == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    eytz_fill(st, 0, 1);
+    return 0;
+}
+
+void symtab_free(struct symtab_s *st) {
+    free(st->syms);
+    free(st->eytz);
+    free(st->eytz_pos);
+    outbuf_free(&st->names);
+    memset(st, 0, sizeof(*st));
+}
+
+// the symbol addr belongs to, NULL if none
+const struct symtab_sym_s *symtab_find(const struct symtab_s *st, uint32_t addr) {
+    unsigned k = 1, pos;
+    uint32_t n;
+    while (k <= st->num) {
+        k = 2 * k + (st->eytz[k] <= addr);
+    }
+    k >>= __builtin_ffs(~k);
+    // k is the first symbol above addr, 0 if there is none
+    pos = k ? st->eytz_pos[k] : st->num;
+    if (pos == 0) {
+        return NULL;
+    }
+    for (n = pos - 1; n != SYMTAB_NONE; n = st->syms[n].parent) {
+        if (covers(&st->syms[n], addr)) {
+            return &st->syms[n];
+        }
+    }
+    return NULL;
+}
+
+const char *symtab_name(const struct symtab_s *st, const struct symtab_sym_s *sym) {
+    return st->names.data + sym->name;
+}
+
+// "name" or "name+0xoff", nothing if no symbol covers addr
+void symtab_annotate(const struct symtab_s *st, uint32_t addr, struct outbuf_s *ob) {
+    const struct symtab_sym_s *sym = symtab_find(st, addr);
+    if (sym == NULL) {
+        return;
+    }
+    outbuf_puts(ob, symtab_name(st, sym));
+    if (addr != sym->addr) {
+        outbuf_printf(ob, "+0x%X", addr - sym->addr);
+    }
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "taskpool.h"
+
+struct task_s {
+    task_fn fn;
+    void *arg;
+};
+
+// ring of tasks, top and bottom only ever grow, size is bottom - top
+struct deque_s {
+    pthread_mutex_t lock;
+    struct task_s *tasks;
+    unsigned cap;           // power of 2
+    unsigned top, bottom;
+};
+
+struct taskpool_s {
+    unsigned num_workers;
+    pthread_t *threads;
+    struct deque_s *deques;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;     // tasks were queued
+    pthread_cond_t done_cv;     // pending dropped to 0
+    unsigned queued;            // tasks sitting in deques
+    unsigned pending;           // tasks submitted and not finished
+    unsigned next_deque;        // round robin for submissions from outside the pool
+    int shutdown;
+};
+
+struct worker_arg_s {
+    struct taskpool_s *pool;
+    unsigned id;
+};
+
+static __thread struct taskpool_s *self_pool;
+static __thread unsigned self_id;
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    return p;
+}
+
+static void deque_push(struct deque_s *d, task_fn fn, void *arg) {
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom - d->top == d->cap) {
+        unsigned n, cap = d->cap * 2;
+        struct task_s *tasks = xmalloc(cap * sizeof(*tasks));
+        for (n = d->top; n != d->bottom; n++) {
+            tasks[n & (cap - 1)] = d->tasks[n & (d->cap - 1)];
+        }
+        free(d->tasks);
+        d->tasks = tasks;
+        d->cap = cap;
+    }
+    d->tasks[d->bottom & (d->cap - 1)].fn = fn;
+    d->tasks[d->bottom & (d->cap - 1)].arg = arg;
+    d->bottom++;
+    pthread_mutex_unlock(&d->lock);
+}
+
+// owner end, newest first: the pieces of a job it just split stay cache-warm
+static int deque_pop(struct deque_s *d, struct task_s *t) {
+    int ret = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom != d->top) {
+        d->bottom--;
+        *t = d->tasks[d->bottom & (d->cap - 1)];
+        ret = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ret;
+}
+
+// thief end, oldest first: those tend to be the biggest remaining pieces
+static int deque_steal(struct deque_s *d, struct task_s *t) {
+    int ret = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom != d->top) {
+        *t = d->tasks[d->top & (d->cap - 1)];
+        d->top++;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ret;
+}
+
+static int find_task(struct taskpool_s *pool, unsigned id, struct task_s *t) {
+    unsigned n;
+    if (deque_pop(&pool->deques[id], t)) {
+        return 1;
+    }
+    for (n = 1; n < pool->num_workers; n++) {
+        if (deque_steal(&pool->deques[(id + n) % pool->num_workers], t)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *worker_main(void *p) {
+    struct worker_arg_s *wa = p;
+    struct taskpool_s *pool = wa->pool;
+    unsigned id = wa->id;
+    struct task_s t;
+
+    free(wa);
+    self_pool = pool;
+    self_id = id;
+    for (;;) {
+        if (find_task(pool, id, &t)) {
+            __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+            t.fn(t.arg, id);
+            if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->done_cv);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0 && !pool->shutdown) {
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+        }
+        if (pool->shutdown && __atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+unsigned taskpool_default_workers(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+struct taskpool_s *taskpool_create(unsigned num_workers) {
+    struct taskpool_s *pool = xmalloc(sizeof(*pool));
+    unsigned n;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->num_workers = num_workers ? num_workers : 1;
+    pool->threads = xmalloc(pool->num_workers * sizeof(pthread_t));
+    pool->deques = xmalloc(pool->num_workers * sizeof(struct deque_s));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+    for (n = 0; n < pool->num_workers; n++) {
+        struct deque_s *d = &pool->deques[n];
+        pthread_mutex_init(&d->lock, NULL);
+        d->cap = 64;
+        d->tasks = xmalloc(d->cap * sizeof(struct task_s));
+        d->top = d->bottom = 0;
+    }
+    for (n = 0; n < pool->num_workers; n++) {
+        struct worker_arg_s *wa = xmalloc(sizeof(*wa));
+        wa->pool = pool;
+        wa->id = n;
+        if (pthread_create(&pool->threads[n], NULL, worker_main, wa) != 0) {
+            fprintf(stderr, "Cannot start worker thread\n");
+            exit(-1);
+        }
+    }
+    return pool;
+}
+
+void taskpool_destroy(struct taskpool_s *pool) {
+    unsigned n;
+    taskpool_wait(pool);
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+    for (n = 0; n < pool->num_workers; n++) {
+        pthread_join(pool->threads[n], NULL);
+        pthread_mutex_destroy(&pool->deques[n].lock);
+        free(pool->deques[n].tasks);
+    }
+    pthread_cond_destroy(&pool->done_cv);
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
+
+unsigned taskpool_num_workers(const struct taskpool_s *pool) {
+    return pool->num_workers;
+}
+
+void taskpool_submit(struct taskpool_s *pool, task_fn fn, void *arg) {
+    unsigned id;
+    if (self_pool == pool) {
+        id = self_id;
+    }
+    else {
+        id = pool->next_deque++ % pool->num_workers;
+    }
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+    deque_push(&pool->deques[id], fn, arg);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// waits until every submitted task, including ones submitted by tasks, has finished
+void taskpool_wait(struct taskpool_s *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) != 0) {
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
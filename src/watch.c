@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "ingest.h"
+#include "batch.h"
+#include "watch.h"
+
+/*
+An upload directory is watched with inotify for files that were closed
+after writing or moved in, which is when a dump is complete.  Each read
+of the inotify fd is one list for the batch code, decoded right away by
+the same workers, jobs and buffers, which stay warm between events.
+Without an output directory the dumps go to stdout, labelled; with one,
+each dump gets NAME.txt (NAME.json with --json) there, written under a
+dot name and renamed when complete, so readers never see half a result.
+Files present before the watch started are left alone, as are dot files
+and directories.
+*/
+
+#define EVENT_BUF 16384
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static int same_dir(const char *a, const char *b) {
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+static int decode_to_dir(struct batch_s *b, const struct batch_opts_s *opts, const char *path,
+                         const char *name, const char *out_dir) {
+    struct ingest_list_s one = { (char **)&path, 1, 1 };
+    const char *ext = opts->json ? "json" : "txt";
+    char *tmp, *dst;
+    FILE *f;
+    int ret = -1;
+
+    if (asprintf(&tmp, "%s/.%s.%s", out_dir, name, ext) < 0) {
+        return -1;
+    }
+    if (asprintf(&dst, "%s/%s.%s", out_dir, name, ext) < 0) {
+        free(tmp);
+        return -1;
+    }
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot write %s\n", tmp);
+    }
+    else {
+        ret = batch_decode(b, &one, f);
+        if (fclose(f) != 0) {
+            ret = -1;
+        }
+        if (ret == 0 && rename(tmp, dst) < 0) {
+            fprintf(stderr, "Cannot write %s\n", dst);
+            ret = -1;
+        }
+        if (ret < 0) {
+            unlink(tmp);
+        }
+    }
+    free(tmp);
+    free(dst);
+    return ret;
+}
+
+int watch_run(const struct batch_opts_s *opts, const char *dir, const char *out_dir) {
+    static char buf[EVENT_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct sigaction sa;
+    struct batch_s *b;
+    int fd, failed = 0;
+
+    if (out_dir && same_dir(dir, out_dir)) {
+        fprintf(stderr, "--out-dir must not be the watched directory\n");
+        return -1;
+    }
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+        fprintf(stderr, "Cannot watch %s: %s\n", dir, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    b = batch_create(opts);
+    if (b == NULL) {
+        close(fd);
+        return -1;
+    }
+    // no SA_RESTART, the blocking read has to return
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!stop) {
+        struct ingest_list_s list = {};
+        char *p;
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Cannot watch %s: %s\n", dir, strerror(errno));
+            failed = 1;
+            break;
+        }
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            char *path;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                fprintf(stderr, "%s: inotify queue overflow, dumps missed\n", dir);
+            }
+            if (ev->len == 0 || (ev->mask & IN_ISDIR) || ev->name[0] == '.') {
+                continue;
+            }
+            if (out_dir) {
+                if (asprintf(&path, "%s/%s", dir, ev->name) < 0) {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(-1);
+                }
+                if (decode_to_dir(b, opts, path, ev->name, out_dir) < 0) {
+                    failed = 1;
+                }
+                free(path);
+            }
+            else {
+                if (asprintf(&path, "%s/%s", dir, ev->name) < 0 || ingest_list_add(&list, path) < 0) {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(-1);
+                }
+                free(path);
+            }
+        }
+        if (list.num > 0 && batch_decode(b, &list, stdout) < 0) {
+            failed = 1;
+        }
+        ingest_list_free(&list);
+    }
+
+    batch_destroy(b);
+    close(fd);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuinfo.h"
+#include "arena.h"
+#include "outbuf.h"
+#include "json.h"
+#include "symtab.h"
+#include "xlat.h"
+
+const char *regionhead = "Virt.addr,Virt.end,Phys.addr,Size,NG bit,Domain,S bit,Privileged/Nonpriv.,Effective,Caching,Memtype,XN bit\n";
+const char *translatehead = "Virt.addr,Phys.addr,Region,Region end,NG bit,Domain,S bit,Privileged/Nonpriv.,Effective,Caching,Memtype,XN bit\n";
+
+#if defined(__i386__) || defined(__x86_64__)
+#define RUN_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define RUN_CLONES
+#endif
+
+typedef uint32_t v8u __attribute__((vector_size(32)));
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+
+void xlat_init(struct xlat_s *x) {
+    x->regions = NULL;
+    x->num = 0;
+    x->cap = 0;
+    x->arena = NULL;
+    x->mair[0] = x->mair[1] = 0;
+    x->remap.tre = 0;
+    cpuinfo_dacr_init(&x->dacr, 0x55555555);
+}
+
+void xlat_init_arena(struct xlat_s *x, struct arena_s *arena) {
+    xlat_init(x);
+    x->arena = arena;
+}
+
+void xlat_free(struct xlat_s *x) {
+    if (x->arena == NULL) {
+        free(x->regions);
+    }
+    xlat_init(x);
+}
+
+void xlat_reset(struct xlat_s *x) {
+    x->num = 0;
+}
+
+// mappings must be added in VA order
+void xlat_add(struct xlat_s *x, uint32_t va, uint64_t pa, uint64_t size, const struct xlat_attr_s *attr) {
+    struct xlat_region_s *r = x->num ? &x->regions[x->num - 1] : NULL;
+    if (r && r->va + r->size == va && r->pa + r->size == pa
+          && memcmp(&r->attr, attr, sizeof(*attr)) == 0) {
+        r->size += size;
+        return;
+    }
+    if (x->num == x->cap) {
+        unsigned cap = x->cap ? 2 * x->cap : 64;
+        r = x->arena ? arena_grow(x->arena, x->regions, x->cap * sizeof(*r), cap * sizeof(*r))
+                     : realloc(x->regions, cap * sizeof(*r));
+        if (r == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        x->regions = r;
+        x->cap = cap;
+    }
+    r = &x->regions[x->num++];
+    r->va = va;
+    r->pa = pa;
+    r->size = size;
+    r->attr = *attr;
+}
+
+// appends an index that covers higher VAs, merging across the seam
+void xlat_append(struct xlat_s *x, const struct xlat_s *src) {
+    unsigned n;
+    for (n = 0; n < src->num; n++) {
+        xlat_add(x, src->regions[n].va, src->regions[n].pa, src->regions[n].size, &src->regions[n].attr);
+    }
+}
+
+const struct xlat_region_s *xlat_lookup(const struct xlat_s *x, uint32_t va) {
+    unsigned lo = 0, hi = x->num;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        const struct xlat_region_s *r = &x->regions[mid];
+        if (va < r->va) {
+            hi = mid;
+        }
+        else if (va - r->va >= r->size) {
+            lo = mid + 1;
+        }
+        else {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/*
+Length of the run e[0], e[0] + step, e[0] + 2*step, ... of at most n
+descriptors: consecutive pages or sections with identical attributes,
+which is what most of a real table is.  Compared 8 or 4 at a time.
+*/
+RUN_CLONES
+unsigned xlat_run32(const uint32_t *e, unsigned n, uint32_t step) {
+    v8u expect, inc, v, d;
+    unsigned i = 0, k;
+    for (k = 0; k < 8; k++) {
+        expect[k] = e[0] + k * step;
+    }
+    inc = (v8u){} + 8 * step;
+    for (; i + 8 <= n; i += 8) {
+        uint32_t any = 0;
+        memcpy(&v, e + i, sizeof(v));
+        d = v ^ expect;
+        for (k = 0; k < 8; k++) {
+            any |= d[k];
+        }
+        if (any) {
+            break;
+        }
+        expect += inc;
+    }
+    for (; i < n && e[i] == e[0] + i * step; i++) {
+    }
+    return i;
+}
+
+RUN_CLONES
+unsigned xlat_run64(const uint64_t *e, unsigned n, uint64_t step) {
+    v4u64 expect, inc, v, d;
+    unsigned i = 0, k;
+    for (k = 0; k < 4; k++) {
+        expect[k] = e[0] + k * step;
+    }
+    inc = (v4u64){} + 4 * step;
+    for (; i + 4 <= n; i += 4) {
+        uint64_t any = 0;
+        memcpy(&v, e + i, sizeof(v));
+        d = v ^ expect;
+        for (k = 0; k < 4; k++) {
+            any |= d[k];
+        }
+        if (any) {
+            break;
+        }
+        expect += inc;
+    }
+    for (; i < n && e[i] == e[0] + i * step; i++) {
+    }
+    return i;
+}
+
+// MAIR cache policy of one nibble: write-through/back, transient, read/write allocate
+static const char *mair_policies[] = {
+    "rsrvd", "WT-T W", "WT-T R", "WT-T RW", "NC", "WB-T W", "WB-T R", "WB-T RW",
+    "WT NA", "WT W", "WT R", "WT RW", "WB NA", "WB W", "WB R", "WB RW",
+};
+
+// caching needs 40 bytes
+void xlat_memattr(const struct xlat_attr_s *a, const uint32_t *mair, const struct cpuinfo_remap_s *remap,
+                  char *caching, const char **memtype) {
+    unsigned attr;
+    if (a->format == XLAT_SHORT) {
+        char *c = "", *m = "";
+        cpuinfo_memattr(((a->memattr & 0x1c) << 10) | ((a->memattr & 3) << 2), remap, &c, &m);
+        strcpy(caching, c);
+        *memtype = m;
+        return;
+    }
+    attr = (mair[(a->memattr >> 2) & 1] >> (8 * (a->memattr & 3))) & 0xff;
+    if (attr == 0) {
+        strcpy(caching, "STR ORD");
+        *memtype = "Strongly-ordered";
+    }
+    else if (attr == 4) {
+        strcpy(caching, "DEV");
+        *memtype = "Device";
+    }
+    else if ((attr & 0xf0) == 0 || (attr & 0x0f) == 0) {
+        strcpy(caching, "rsrvd");
+        *memtype = "";
+    }
+    else {
+        sprintf(caching, "OUTER %s INNER %s", mair_policies[attr >> 4], mair_policies[attr & 15]);
+        *memtype = "Normal";
+    }
+}
+
+const char *xlat_shareable(const struct xlat_attr_s *a) {
+    static const char *sh[] = { "", "rsrvd", "Outer shareable", "Inner shareable" };
+    if (a->format == XLAT_SHORT) {
+        return a->shareable ? "Shareable" : "";
+    }
+    return sh[a->shareable & 3];
+}
+
+const char *xlat_xn(const struct xlat_attr_s *a) {
+    if (a->xn) {
+        return "No exec";
+    }
+    return a->pxn ? "Priv no exec" : "";
+}
+
+// access after DACR: AP bits for clients, full for managers, none for no access
+const char *xlat_effperm(const struct xlat_s *x, const struct xlat_attr_s *a) {
+    if (a->domain == XLAT_NO_DOMAIN) {
+        return cpuinfo_accperm(a->ap);
+    }
+    return cpuinfo_effperm(&x->dacr, a->domain, a->ap);
+}
+
+static void print_head(const char *head, const struct symtab_s *syms, struct outbuf_s *ob) {
+    if (syms == NULL) {
+        outbuf_puts(ob, head);
+        return;
+    }
+    outbuf_write(ob, head, strlen(head) - 1);
+    outbuf_puts(ob, ",Symbol\n");
+}
+
+static void print_symbol(const struct symtab_s *syms, uint32_t va, struct outbuf_s *ob) {
+    if (syms) {
+        outbuf_write(ob, ",", 1);
+        symtab_annotate(syms, va, ob);
+    }
+    outbuf_write(ob, "\n", 1);
+}
+
+// "NG bit,Domain,S bit,Privileged/Nonpriv.,Effective,Caching,Memtype,XN bit", without the line end
+static void print_attr(const struct xlat_s *x, const struct xlat_attr_s *a, struct outbuf_s *ob) {
+    char caching[40], domain[4] = "";
+    const char *memtype;
+    xlat_memattr(a, x->mair, &x->remap, caching, &memtype);
+    if (a->domain != XLAT_NO_DOMAIN) {
+        sprintf(domain, "%u", a->domain);
+    }
+    outbuf_printf(ob, "%s,%s,%s,%s,%s,", a->ng ? "Nonglobal" : "Global", domain,
+                  xlat_shareable(a), cpuinfo_accperm(a->ap), xlat_effperm(x, a));
+    outbuf_csv_cell(ob, caching); // "WRBCK, NAW" has a comma of its own
+    outbuf_printf(ob, ",%s,%s", memtype, xlat_xn(a));
+}
+
+void xlat_print_regions(const struct xlat_s *x, const struct symtab_s *syms, struct outbuf_s *ob) {
+    unsigned n;
+    print_head(regionhead, syms, ob);
+    for (n = 0; n < x->num; n++) {
+        const struct xlat_region_s *r = &x->regions[n];
+        outbuf_printf(ob, "0x%08X,0x%08X,0x%08llX,0x%llX,", r->va, (uint32_t)(r->va + r->size - 1),
+                      (unsigned long long)r->pa, (unsigned long long)r->size);
+        print_attr(x, &r->attr, ob);
+        print_symbol(syms, r->va, ob);
+    }
+}
+
+void xlat_print_translation(const struct xlat_s *x, uint32_t va, const struct symtab_s *syms, struct outbuf_s *ob) {
+    const struct xlat_region_s *r = xlat_lookup(x, va);
+    print_head(translatehead, syms, ob);
+    if (r == NULL) {
+        outbuf_printf(ob, "0x%08X,Fault", va);
+        if (syms) {
+            outbuf_puts(ob, ",,,,,,,,,,"); // up to XN bit
+        }
+        print_symbol(syms, va, ob);
+        return;
+    }
+    outbuf_printf(ob, "0x%08X,0x%08llX,0x%08X,0x%08X,", va, (unsigned long long)(r->pa + (va - r->va)),
+                  r->va, (uint32_t)(r->va + r->size - 1));
+    print_attr(x, &r->attr, ob);
+    print_symbol(syms, va, ob);
+}
+
+static void json_attr(struct json_s *j, const struct xlat_s *x, const struct xlat_attr_s *a) {
+    char caching[40];
+    const char *memtype;
+    xlat_memattr(a, x->mair, &x->remap, caching, &memtype);
+    json_bool(j, "ng", a->ng);
+    if (a->domain != XLAT_NO_DOMAIN) {
+        json_uint(j, "domain", a->domain);
+        json_string(j, "domain_type", cpuinfo_domain_type(&x->dacr, a->domain));
+    }
+    json_string(j, "shareable", xlat_shareable(a));
+    json_string(j, "access", cpuinfo_accperm(a->ap));
+    json_string(j, "effective_access", xlat_effperm(x, a));
+    json_string(j, "caching", caching);
+    json_string(j, "memtype", memtype);
+    json_bool(j, "xn", a->xn);
+    json_bool(j, "pxn", a->pxn);
+    json_bool(j, "ns", a->ns);
+}
+
+static void json_symbol(struct json_s *j, const struct symtab_s *syms, uint32_t va) {
+    const struct symtab_sym_s *sym;
+    if (syms == NULL || (sym = symtab_find(syms, va)) == NULL) {
+        return;
+    }
+    json_string(j, "symbol", symtab_name(syms, sym));
+    json_uint(j, "symbol_offset", va - sym->addr);
+}
+
+// the regions as a "regions" array of the current JSON object
+void xlat_json_regions(const struct xlat_s *x, const struct symtab_s *syms, struct json_s *j) {
+    unsigned n;
+    json_array(j, "regions");
+    for (n = 0; n < x->num; n++) {
+        const struct xlat_region_s *r = &x->regions[n];
+        json_object(j, NULL);
+        json_uint(j, "va", r->va);
+        json_uint(j, "pa", r->pa);
+        json_uint(j, "size", r->size);
+        json_attr(j, x, &r->attr);
+        json_symbol(j, syms, r->va);
+        json_object_end(j);
+    }
+    json_array_end(j);
+}
+
+void xlat_json_translation(const struct xlat_s *x, uint32_t va, const struct symtab_s *syms, struct json_s *j) {
+    const struct xlat_region_s *r = xlat_lookup(x, va);
+    json_object(j, "translation");
+    json_uint(j, "va", va);
+    if (r == NULL) {
+        json_bool(j, "fault", 1);
+    }
+    else {
+        json_uint(j, "pa", r->pa + (va - r->va));
+        json_uint(j, "region", r->va);
+        json_uint(j, "region_size", r->size);
+        json_attr(j, x, &r->attr);
+    }
+    json_symbol(j, syms, va);
+    json_object_end(j);
+}
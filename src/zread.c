@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "zread.h"
+
+struct zread_s {
+    int fd;
+    int codec;
+    int eof;                    // no more input in the file
+    int done;                   // end of the compressed stream
+    size_t in_pos, in_len;
+#ifdef HAVE_ZLIB
+    z_stream gz;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zs;
+#endif
+    unsigned char in[ZREAD_IN_SIZE];
+};
+
+int zread_detect(const void *buf, size_t len) {
+    const unsigned char *p = buf;
+    if (len >= 2 && p[0] == 0x1f && p[1] == 0x8b) {
+        return ZREAD_GZIP;
+    }
+    if (len >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd) {
+        return ZREAD_ZSTD;
+    }
+    return ZREAD_NONE;
+}
+
+int zread_supported(int codec) {
+    switch (codec) {
+#ifdef HAVE_ZLIB
+        case ZREAD_GZIP: return 1;
+#endif
+#ifdef HAVE_ZSTD
+        case ZREAD_ZSTD: return 1;
+#endif
+    }
+    return 0;
+}
+
+// reads the file from its current offset; on success z owns fd
+struct zread_s *zread_open(int fd, int codec) {
+    struct zread_s *z;
+    if (!zread_supported(codec)) {
+        return NULL;
+    }
+    z = calloc(1, sizeof(*z));
+    if (z == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    z->fd = fd;
+    z->codec = codec;
+#ifdef HAVE_ZLIB
+    if (codec == ZREAD_GZIP && inflateInit2(&z->gz, 15 + 32) != Z_OK) {  // +32: gzip header
+        free(z);
+        return NULL;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (codec == ZREAD_ZSTD) {
+        z->zs = ZSTD_createDStream();
+        if (z->zs == NULL) {
+            free(z);
+            return NULL;
+        }
+        ZSTD_initDStream(z->zs);
+    }
+#endif
+    return z;
+}
+
+static int refill(struct zread_s *z) {
+    ssize_t n;
+    if (z->in_pos < z->in_len || z->eof) {
+        return 0;
+    }
+    n = read(z->fd, z->in, sizeof(z->in));
+    if (n < 0) {
+        return -1;
+    }
+    z->in_pos = 0;
+    z->in_len = n;
+    z->eof = n == 0;
+    return 0;
+}
+
+// one step of the codec, appends to out at *got; 1 at the end of the stream, -1 on errors
+static int step(struct zread_s *z, unsigned char *out, size_t len, size_t *got) {
+#ifdef HAVE_ZLIB
+    if (z->codec == ZREAD_GZIP) {
+        int ret;
+        z->gz.next_in = z->in + z->in_pos;
+        z->gz.avail_in = z->in_len - z->in_pos;
+        z->gz.next_out = out + *got;
+        z->gz.avail_out = len - *got;
+        ret = inflate(&z->gz, Z_NO_FLUSH);
+        z->in_pos = z->in_len - z->gz.avail_in;
+        *got = len - z->gz.avail_out;
+        if (ret == Z_STREAM_END) {      // end of a member, another one may follow (pigz, cat a.gz b.gz)
+            if (refill(z) < 0) {
+                return -1;
+            }
+            if (z->in_pos == z->in_len && z->eof) {
+                return 1;
+            }
+            return inflateReset(&z->gz) == Z_OK ? 0 : -1;
+        }
+        return ret == Z_OK || (ret == Z_BUF_ERROR && !z->eof) ? 0 : -1;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (z->codec == ZREAD_ZSTD) {
+        ZSTD_inBuffer in = { z->in, z->in_len, z->in_pos };
+        ZSTD_outBuffer o = { out, len, *got };
+        size_t ret = ZSTD_decompressStream(z->zs, &o, &in);
+        z->in_pos = in.pos;
+        *got = o.pos;
+        if (ZSTD_isError(ret)) {
+            return -1;
+        }
+        if (ret == 0) {                 // end of a frame, another one may follow
+            if (refill(z) < 0) {
+                return -1;
+            }
+            return z->in_pos == z->in_len && z->eof;
+        }
+        return 0;
+    }
+#endif
+    (void)z;
+    (void)out;
+    (void)len;
+    (void)got;
+    return -1;
+}
+
+// fills buf unless the stream ends first; returns the bytes filled, -1 on errors
+ssize_t zread_read(struct zread_s *z, void *buf, size_t len) {
+    size_t got = 0;
+    while (got < len && !z->done) {
+        size_t before = got, in_before;
+        int ret;
+        if (refill(z) < 0) {
+            return -1;
+        }
+        in_before = z->in_pos;
+        ret = step(z, buf, len, &got);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 1) {
+            z->done = 1;
+        }
+        else if (got == before && z->in_pos == in_before && z->eof) {
+            return -1;                  // truncated
+        }
+    }
+    return got;
+}
+
+void zread_close(struct zread_s *z) {
+    if (z == NULL) {
+        return;
+    }
+#ifdef HAVE_ZLIB
+    if (z->codec == ZREAD_GZIP) {
+        inflateEnd(&z->gz);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (z->codec == ZREAD_ZSTD) {
+        ZSTD_freeDStream(z->zs);
+    }
+#endif
+    close(z->fd);
+    free(z);
+}
+
+// the whole decompressed file in an anonymous mapping, for images that are scanned end to end
+void *zread_load(int fd, int codec, size_t *size) {
+    struct zread_s *z = zread_open(fd, codec);
+    size_t cap = 1 << 20, len = 0;
+    void *map, *old;
+
+    if (z == NULL) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    while (map != MAP_FAILED) {
+        ssize_t n = zread_read(z, (char *)map + len, cap - len);
+        if (n < 0) {
+            munmap(map, cap);
+            map = MAP_FAILED;
+            break;
+        }
+        len += n;
+        if (len < cap) {
+            break;
+        }
+        if (cap * 2 < cap) {
+            munmap(map, cap);
+            map = MAP_FAILED;
+            break;
+        }
+        old = map;
+        map = mremap(old, cap, cap * 2, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) {
+            munmap(old, cap);
+            break;
+        }
+        cap *= 2;
+    }
+    zread_close(z);
+    if (map != MAP_FAILED && len < cap) {
+        old = map;
+        map = mremap(old, cap, len ? len : 1, 0);
+        if (map == MAP_FAILED) {
+            munmap(old, cap);
+        }
+    }
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    *size = len;
+    return map;
+}